@@ -0,0 +1,21 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(constant_id = 0) const uint SHADING = 0;
+
+// Only the elements up to the material count are written.
+layout(set = 1, binding = 0) uniform sampler2D materialTextures[];
+
+layout(location = 0) in vec3 fragNormal;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragMaterial;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    if (SHADING == 1) {
+        outColor = vec4(normalize(fragNormal) * 0.5 + 0.5, 1.0);
+    } else {
+        outColor = texture(materialTextures[nonuniformEXT(fragMaterial)], fragTexCoord);
+    }
+}
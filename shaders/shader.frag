@@ -1,12 +1,18 @@
 #version 450
 
+layout(constant_id = 0) const uint SHADING = 0;
+
 layout(binding = 1) uniform sampler2D texSampler;
 
-layout(location = 0) in vec3 fragColor;
+layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    if (SHADING == 1) {
+        outColor = vec4(normalize(fragNormal) * 0.5 + 0.5, 1.0);
+    } else {
+        outColor = texture(texSampler, fragTexCoord);
+    }
 }
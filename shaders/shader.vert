@@ -4,17 +4,36 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
+    mat4 modelViewProj;
 } ubo;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
-layout(location = 2) in vec2 inTexCoord;
+layout(push_constant) uniform VertexDequantization {
+    vec4 offset;
+    vec4 scale;
+} dequantization;
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inTexCoord;
+layout(location = 2) in vec2 inNormal;
+layout(location = 3) in mat4 inModel;
+
+layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterial;
+
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0.0) {
+        normal.xy = (1.0 - abs(normal.yx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(normal);
+}
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
+    vec3 position = dequantization.offset.xyz + inPosition.xyz * dequantization.scale.xyz;
+    gl_Position = ubo.modelViewProj * (inModel * vec4(position, 1.0));
+    fragNormal = mat3(ubo.model) * (mat3(inModel) * decodeOctahedral(inNormal));
     fragTexCoord = inTexCoord;
+    // The material rides in the fourth position component.
+    fragMaterial = uint(inPosition.w * 65535.0 + 0.5);
 }
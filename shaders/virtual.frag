@@ -0,0 +1,57 @@
+#version 450
+
+layout(constant_id = 0) const uint SHADING = 0;
+
+// VT_PAGE_TEXELS, VT_PAGE_BORDER and VT_CACHE_PAGES_PER_SIDE.
+const float PAGE_TEXELS = 128.0;
+const float PAGE_BORDER = 1.0;
+const float CACHE_PAGES_PER_SIDE = 16.0;
+const float SLOT_TEXELS = PAGE_TEXELS + 2.0 * PAGE_BORDER;
+
+// The physical page cache.
+layout(binding = 1) uniform sampler2D texSampler;
+layout(binding = 2) uniform usampler2D pageTable;
+
+layout(std430, binding = 3) buffer Feedback {
+    uvec2 size;
+    uint levelCount;
+    uint padding;
+    uint levelOffsets[16];
+    uint requested[];
+} feedback;
+
+layout(location = 0) in vec3 fragNormal;
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    if (SHADING == 1) {
+        outColor = vec4(normalize(fragNormal) * 0.5 + 0.5, 1.0);
+        return;
+    }
+
+    vec2 texels = clamp(fragTexCoord, 0.0, 1.0) * vec2(feedback.size);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    int level = int(clamp(lod, 0.0, float(feedback.levelCount - 1)));
+
+    ivec2 pages = textureSize(pageTable, level);
+    ivec2 page = min(ivec2(texels / (PAGE_TEXELS * float(1 << level))), pages - 1);
+
+    // One pixel in each 4x4 block is enough to find every page in view.
+    if ((uint(gl_FragCoord.x) & 3u) == 0u && (uint(gl_FragCoord.y) & 3u) == 0u) {
+        feedback.requested[feedback.levelOffsets[level] + page.y * pages.x + page.x] = 1u;
+    }
+
+    // The entry points at the page or its closest resident ancestor.
+    uint entry = texelFetch(pageTable, page, level).r;
+    int residentLevel = int((entry >> 16) & 0xffu);
+    vec2 slot = vec2(entry & 0xffu, (entry >> 8) & 0xffu);
+    vec2 residentPage = vec2(page >> (residentLevel - level));
+    vec2 inPage = clamp(texels / float(1 << residentLevel) - residentPage * PAGE_TEXELS, 0.0, PAGE_TEXELS);
+
+    vec2 cacheTexel = slot * SLOT_TEXELS + PAGE_BORDER + inPage;
+    outColor = textureLod(texSampler, cacheTexel / (CACHE_PAGES_PER_SIDE * SLOT_TEXELS), 0.0);
+}
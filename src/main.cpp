@@ -3,10 +3,9 @@
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
-#define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtx/hash.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -14,20 +13,48 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VULKAN_CUBES_SSE2
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <cstring>
+#include <cstdio>
 #include <cstdlib>
 #include <cstdint>
 #include <limits>
+#include <map>
+#include <memory>
 #include <array>
 #include <optional>
 #include <set>
-#include <unordered_map>
+#include <string>
+#include <utility>
+
+// Set by the build to the glslc it compiles shaders with and to the shader
+// sources, which --hot-reload watches instead of the copies next to the
+// executable.
+#ifndef GLSLC_EXECUTABLE
+#define GLSLC_EXECUTABLE "glslc"
+#endif
+#ifndef SHADER_SOURCE_DIR
+#define SHADER_SOURCE_DIR "shaders"
+#endif
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
@@ -35,12 +62,65 @@ const uint32_t HEIGHT = 600;
 const std::string MODEL_PATH = "models/viking_room.obj";
 const std::string TEXTURE_PATH = "textures/viking_room.png";
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Pre-compressed KTX2 variants of TEXTURE_PATH in order of preference. The
+// first one that exists and whose format the device can sample is used.
+const std::vector<std::string> COMPRESSED_TEXTURE_PATHS = {
+    "textures/viking_room.bc7.ktx2",
+    "textures/viking_room.astc.ktx2",
+    "textures/viking_room.bc1.ktx2"};
+
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+// Origin of the startup timeline, taken before main() runs.
+const std::chrono::steady_clock::time_point PROCESS_START = std::chrono::steady_clock::now();
+
+// Workers for the startup steps that need no shared Vulkan state: texture
+// decode, model loading and the pipeline builds.
+const uint32_t STARTUP_THREADS = 4;
+
+// How often --hot-reload checks the shader sources for changes.
+const std::chrono::milliseconds SHADER_RELOAD_POLL_INTERVAL(250);
+
+// Resize events arriving closer together than this are handled by a single
+// swap chain recreation once they stop.
+const std::chrono::milliseconds RESIZE_COALESCE_INTERVAL(50);
+
+const uint32_t STREAM_CHUNK_TRIANGLES = 16384;
+const uint32_t STREAM_CHUNKS_PER_FRAME = 4;
+
+// FIFO post-transform cache size used both to optimize and to measure.
+const uint32_t VERTEX_CACHE_SIZE = 16;
+// The overdraw order is kept only if it costs at most this much ACMR.
+const double OVERDRAW_ACMR_THRESHOLD = 1.05;
+
+// Each LOD aims for half the triangles of the previous one and is used once
+// an instance's projected bounding sphere radius, as a fraction of half the
+// screen height, drops below LOD_SCREEN_SIZE / 2^(level - 1).
+const uint32_t MAX_LOD_LEVELS = 4;
+const float LOD_SCREEN_SIZE = 0.5f;
+
+// Virtual texture pages are VT_PAGE_TEXELS square plus a VT_PAGE_BORDER
+// texel border copied from their neighbours, so bilinear filtering never
+// reads another page. The physical cache holds VT_CACHE_PAGES_PER_SIDE^2
+// pages and takes at most VT_UPLOADS_PER_FRAME new ones per frame. The
+// first three match the constants of virtual.frag.
+const uint32_t VT_PAGE_TEXELS = 128;
+const uint32_t VT_PAGE_BORDER = 1;
+const uint32_t VT_SLOT_TEXELS = VT_PAGE_TEXELS + 2 * VT_PAGE_BORDER;
+const uint32_t VT_CACHE_PAGES_PER_SIDE = 16;
+const uint32_t VT_UPLOADS_PER_FRAME = 16;
+const uint32_t VT_MAX_LEVELS = 16;
+
+// Upper bound of the bindless material texture array, lowered to what the
+// device allows.
+const uint32_t MAX_MATERIAL_TEXTURES = 1024;
 
 const std::vector<const char *> validationLayers = {
     "VK_LAYER_KHRONOS_validation"};
 
-const std::vector<const char *> deviceExtensions = {
+const std::vector<const char *> swapChainDeviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
 #ifdef NDEBUG
@@ -71,271 +151,4341 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
   }
 }
 
-struct QueueFamilyIndices
+// Render modes are variants of the graphics pipeline. With graphics pipeline
+// libraries, cull and polygon mode select the pre-rasterization part,
+// shading (a specialization constant of shader.frag) and blending select
+// the fragment shader part, and blending also selects the output part.
+struct RenderMode
 {
-  std::optional<uint32_t> graphicsFamily;
-  std::optional<uint32_t> presentFamily;
+  const char *name;
+  VkCullModeFlags cullMode;
+  VkPolygonMode polygonMode;
+  uint32_t shading;
+  bool blend;
+};
 
-  bool isComplete()
+// Values of shader.frag's SHADING constant.
+const uint32_t SHADING_TEXTURED = 0;
+const uint32_t SHADING_NORMALS = 1;
+
+const std::array<RenderMode, 4> RENDER_MODES = {{
+    {"shaded", VK_CULL_MODE_BACK_BIT, VK_POLYGON_MODE_FILL, SHADING_TEXTURED, false},
+    {"wireframe", VK_CULL_MODE_NONE, VK_POLYGON_MODE_LINE, SHADING_TEXTURED, false},
+    {"normals", VK_CULL_MODE_BACK_BIT, VK_POLYGON_MODE_FILL, SHADING_NORMALS, false},
+    {"xray", VK_CULL_MODE_NONE, VK_POLYGON_MODE_FILL, SHADING_TEXTURED, true},
+}};
+
+uint32_t parseRenderMode(const std::string &name)
+{
+  for (uint32_t i = 0; i < RENDER_MODES.size(); i++)
   {
-    return graphicsFamily.has_value() && presentFamily.has_value();
+    if (name == RENDER_MODES[i].name)
+      return i;
   }
-};
+  throw std::invalid_argument("unknown render mode: " + name);
+}
 
-struct SwapChainSupportDetails
+struct Options
 {
-  VkSurfaceCapabilitiesKHR capabilities;
-  std::vector<VkSurfaceFormatKHR> formats;
-  std::vector<VkPresentModeKHR> presentModes;
+  bool headless = false;
+  uint32_t frameCount = 0;
+  uint32_t benchmarkFrames = 0;
+  uint32_t dedupThreads = 1;
+  bool stream = false;
+  size_t streamMemoryBytes = 64 * 1024 * 1024;
+  bool optimizeMesh = true;
+  bool optimizeOverdraw = false;
+  uint32_t instanceCount = 1;
+  bool gpuCulling = false;
+  uint32_t lodLevels = 1;
+  uint32_t recordThreads = 0;
+  bool cacheCommandBuffers = false;
+  bool hotReload = false;
+  bool startupTimeline = false;
+  bool virtualTexture = false;
+  bool bindless = false;
+  uint32_t renderMode = 0;
+  uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+  // Zero keeps the surface's minimum plus one.
+  uint32_t swapchainImages = 0;
+  std::optional<VkPresentModeKHR> presentMode;
+  // Zero leaves frame starts unpaced.
+  double targetFps = 0.0;
+  std::string outputPath;
 };
 
-struct Vertex
+VkPresentModeKHR parsePresentMode(const std::string &name)
 {
-  glm::vec3 pos;
-  glm::vec3 color;
-  glm::vec2 texCoord;
+  if (name == "immediate")
+    return VK_PRESENT_MODE_IMMEDIATE_KHR;
+  if (name == "mailbox")
+    return VK_PRESENT_MODE_MAILBOX_KHR;
+  if (name == "fifo")
+    return VK_PRESENT_MODE_FIFO_KHR;
+  if (name == "fifo-relaxed")
+    return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+
+  throw std::invalid_argument("unknown present mode: " + name);
+}
+
+const char *presentModeName(VkPresentModeKHR presentMode)
+{
+  switch (presentMode)
+  {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "immediate";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "mailbox";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "fifo";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "fifo-relaxed";
+  default:
+    return "other";
+  }
+}
+
+Options parseOptions(int argc, char **argv)
+{
+  Options options;
+  bool framesGiven = false;
 
-  static VkVertexInputBindingDescription getBindingDescription()
+  for (int i = 1; i < argc; i++)
   {
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+
+    if (arg == "--headless")
+    {
+      options.headless = true;
+    }
+    else if (arg == "--frames" && hasValue)
+    {
+      options.frameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+      framesGiven = true;
+    }
+    else if (arg == "--benchmark" && hasValue)
+    {
+      options.benchmarkFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+      if (options.benchmarkFrames == 0)
+      {
+        throw std::invalid_argument("--benchmark needs at least one frame");
+      }
+      options.frameCount = options.benchmarkFrames;
+    }
+    else if (arg == "--dedup-threads" && hasValue)
+    {
+      options.dedupThreads = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+    }
+    else if (arg == "--stream")
+    {
+      options.stream = true;
+    }
+    else if (arg == "--stream-memory" && hasValue)
+    {
+      options.stream = true;
+      options.streamMemoryBytes = static_cast<size_t>(std::stoul(argv[++i])) * 1024 * 1024;
+    }
+    else if (arg == "--no-optimize-mesh")
+    {
+      options.optimizeMesh = false;
+    }
+    else if (arg == "--optimize-overdraw")
+    {
+      options.optimizeOverdraw = true;
+    }
+    else if (arg == "--instances" && hasValue)
+    {
+      options.instanceCount = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+    }
+    else if (arg == "--gpu-culling")
+    {
+      options.gpuCulling = true;
+    }
+    else if (arg == "--lod-levels" && hasValue)
+    {
+      options.lodLevels = std::clamp(static_cast<uint32_t>(std::stoul(argv[++i])), 1u, MAX_LOD_LEVELS);
+    }
+    else if (arg == "--record-threads" && hasValue)
+    {
+      options.recordThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+    }
+    else if (arg == "--cache-command-buffers")
+    {
+      options.cacheCommandBuffers = true;
+    }
+    else if (arg == "--hot-reload")
+    {
+      options.hotReload = true;
+    }
+    else if (arg == "--startup-timeline")
+    {
+      options.startupTimeline = true;
+    }
+    else if (arg == "--virtual-texture")
+    {
+      options.virtualTexture = true;
+    }
+    else if (arg == "--bindless")
+    {
+      options.bindless = true;
+    }
+    else if (arg == "--render-mode" && hasValue)
+    {
+      options.renderMode = parseRenderMode(argv[++i]);
+    }
+    else if (arg == "--frames-in-flight" && hasValue)
+    {
+      options.framesInFlight = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+    }
+    else if (arg == "--swapchain-images" && hasValue)
+    {
+      options.swapchainImages = static_cast<uint32_t>(std::stoul(argv[++i]));
+    }
+    else if (arg == "--present-mode" && hasValue)
+    {
+      options.presentMode = parsePresentMode(argv[++i]);
+    }
+    else if (arg == "--target-fps" && hasValue)
+    {
+      options.targetFps = std::stod(argv[++i]);
+    }
+    else if (arg == "--output" && hasValue)
+    {
+      options.outputPath = argv[++i];
+    }
+    else
+    {
+      throw std::invalid_argument("unknown or incomplete argument: " + arg);
+    }
+  }
 
-    return bindingDescription;
+  // The benchmark sets the frame count itself.
+  if (framesGiven && options.benchmarkFrames > 0)
+  {
+    throw std::invalid_argument("--frames cannot be combined with --benchmark");
   }
 
-  static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+  if (!options.outputPath.empty() && !options.headless)
   {
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+    throw std::invalid_argument("--output requires --headless");
+  }
 
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+  // Secondary buffers come from per-frame pools that are reset on every
+  // recording, which would invalidate the cached primaries executing them.
+  if (options.cacheCommandBuffers && options.recordThreads > 0)
+  {
+    throw std::invalid_argument("--cache-command-buffers cannot be combined with --record-threads");
+  }
 
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
+  // The level of every instance is picked by the cull pass.
+  if (options.lodLevels > 1 && !options.gpuCulling)
+  {
+    throw std::invalid_argument("--lod-levels requires --gpu-culling");
+  }
 
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+  // Both own binding 1: one as the page cache, the other as the array of
+  // material textures.
+  if (options.bindless && options.virtualTexture)
+  {
+    throw std::invalid_argument("--bindless cannot be combined with --virtual-texture");
+  }
 
-    return attributeDescriptions;
+  // The materials are read from the material library by loadModel(), which
+  // streaming skips.
+  if (options.bindless && options.stream)
+  {
+    throw std::invalid_argument("--bindless cannot be combined with --stream");
   }
 
-  bool operator==(const Vertex &other) const
+  if (options.headless && options.frameCount == 0)
   {
-    return pos == other.pos && color == other.color && texCoord == other.texCoord;
+    options.frameCount = 1;
   }
-};
 
-namespace std
+  return options;
+}
+
+// Quotes `text` for use inside a JSON string.
+std::string escapeJson(const std::string &text)
 {
-  template <>
-  struct hash<Vertex>
+  std::string escaped;
+  for (char c : text)
   {
-    size_t operator()(Vertex const &vertex) const
+    if (c == '"' || c == '\\')
     {
-      return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1);
+      escaped += '\\';
+      escaped += c;
     }
-  };
+    else if (static_cast<unsigned char>(c) < 0x20)
+    {
+      char code[7];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    }
+    else
+    {
+      escaped += c;
+    }
+  }
+  return escaped;
 }
 
-struct UniformBufferObject
-{
-  alignas(16) glm::mat4 model;
-  alignas(16) glm::mat4 view;
-  alignas(16) glm::mat4 proj;
-};
-
-class HelloTriangleApplication
+// Spaces frame starts at a target rate; the caller sleeps until
+// nextFrameStart() before sampling input. When frames take longer than a
+// period from start to GPU completion, a queue is building up somewhere, so
+// the start is pushed back by the excess until latency settles at about one
+// period.
+class FramePacer
 {
 public:
-  void run()
-  {
-    initWindow();
-    initVulkan();
-    mainLoop();
-    cleanup();
-  }
-
-private:
-  GLFWwindow *window;
+  using Clock = std::chrono::steady_clock;
 
-  VkInstance instance;
-  VkDebugUtilsMessengerEXT debugMessenger;
-  VkSurfaceKHR surface;
+  explicit FramePacer(double targetFps)
+      : period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps))) {}
 
-  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-  VkDevice device;
+  Clock::time_point nextFrameStart(Clock::time_point now) const
+  {
+    if (!started)
+      return now;
 
-  VkQueue graphicsQueue;
-  VkQueue presentQueue;
+    Clock::duration excess = averageLatency > period ? std::min(averageLatency - period, period) : Clock::duration::zero();
+    return std::max(now, lastStart + period + excess);
+  }
 
-  VkSwapchainKHR swapChain;
-  std::vector<VkImage> swapChainImages;
-  VkFormat swapChainImageFormat;
-  VkExtent2D swapChainExtent;
-  std::vector<VkImageView> swapChainImageViews;
-  std::vector<VkFramebuffer> swapChainFramebuffers;
+  void frameStarted(Clock::time_point start)
+  {
+    lastStart = start;
+    started = true;
+  }
 
-  VkRenderPass renderPass;
-  VkDescriptorSetLayout descriptorSetLayout;
-  VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
+  void frameCompleted(Clock::duration latency)
+  {
+    averageLatency = averageLatency == Clock::duration::zero() ? latency : (averageLatency * 7 + latency) / 8;
+  }
 
-  VkCommandPool commandPool;
+private:
+  Clock::duration period;
+  Clock::time_point lastStart;
+  Clock::duration averageLatency = Clock::duration::zero();
+  bool started = false;
+};
 
-  VkImage depthImage;
-  VkDeviceMemory depthImageMemory;
-  VkImageView depthImageView;
+class FrameStatistics
+{
+public:
+  void record(const std::string &name, double milliseconds)
+  {
+    for (auto &entry : series)
+    {
+      if (entry.first == name)
+      {
+        entry.second.push_back(milliseconds);
+        return;
+      }
+    }
 
-  VkImage textureImage;
-  VkDeviceMemory textureImageMemory;
-  VkImageView textureImageView;
-  VkSampler textureSampler;
+    series.push_back({name, {milliseconds}});
+  }
 
-  std::vector<Vertex> vertices;
-  std::vector<uint32_t> indices;
-  VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
-  VkBuffer indexBuffer;
-  VkDeviceMemory indexBufferMemory;
+  void writeJson(std::ostream &out, const std::string &indent) const
+  {
+    out << "{";
+    for (size_t i = 0; i < series.size(); i++)
+    {
+      std::vector<double> samples = series[i].second;
+      std::sort(samples.begin(), samples.end());
 
-  std::vector<VkBuffer> uniformBuffers;
-  std::vector<VkDeviceMemory> uniformBuffersMemory;
-  std::vector<void *> uniformBuffersMapped;
+      double sum = 0.0;
+      for (double sample : samples)
+      {
+        sum += sample;
+      }
 
-  VkDescriptorPool descriptorPool;
-  std::vector<VkDescriptorSet> descriptorSets;
+      out << (i == 0 ? "\n" : ",\n") << indent << "  \"" << series[i].first << "\": {"
+          << "\"samples\": " << samples.size()
+          << ", \"mean\": " << sum / samples.size()
+          << ", \"p50\": " << percentile(samples, 0.50)
+          << ", \"p99\": " << percentile(samples, 0.99)
+          << ", \"max\": " << samples.back() << "}";
+    }
+    out << "\n"
+        << indent << "}";
+  }
 
-  std::vector<VkCommandBuffer> commandBuffers;
+private:
+  std::vector<std::pair<std::string, std::vector<double>>> series;
 
-  std::vector<VkSemaphore> imageAvailableSemaphores;
-  std::vector<VkSemaphore> renderFinishedSemaphores;
-  std::vector<VkFence> inFlightFences;
-  uint32_t currentFrame = 0;
+  static double percentile(const std::vector<double> &sorted, double fraction)
+  {
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+  }
+};
 
-  bool framebufferResized = false;
+// Suballocates per-frame data linearly from one persistently mapped buffer
+// that holds a region per frame in flight. A region is rewound when its
+// frame begins, after that frame's previous submission has completed, and
+// shaders reach the data through dynamic uniform buffer offsets, so data
+// that changes every frame needs no buffers or descriptor sets of its own.
+class FrameDataRing
+{
+public:
+  static constexpr VkDeviceSize DEFAULT_REGION_SIZE = 64 * 1024;
 
-  void initWindow()
+  // `mapped` must cover one region of `regionSize` bytes per frame.
+  void init(void *mapped, VkDeviceSize regionSize, VkDeviceSize alignment)
   {
-    glfwInit();
+    this->mapped = static_cast<char *>(mapped);
+    this->alignment = alignment;
+    this->regionSize = (regionSize + alignment - 1) / alignment * alignment;
+  }
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  static VkDeviceSize bufferSize(uint32_t frameCount, VkDeviceSize regionSize, VkDeviceSize alignment)
+  {
+    return frameCount * ((regionSize + alignment - 1) / alignment * alignment);
+  }
 
-    window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-    glfwSetWindowUserPointer(window, this);
-    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+  void begin(uint32_t frame)
+  {
+    regionStart = frame * regionSize;
+    cursor = regionStart;
   }
 
-  static void framebufferResizeCallback(GLFWwindow *window, int width, int height)
+  // Returns the offset of `size` bytes in the buffer, aligned for use as a
+  // dynamic uniform buffer offset.
+  uint32_t allocate(VkDeviceSize size)
   {
-    auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
-    app->framebufferResized = true;
+    VkDeviceSize offset = (cursor + alignment - 1) / alignment * alignment;
+    if (offset + size > regionStart + regionSize)
+    {
+      throw std::runtime_error("frame data ring region is full!");
+    }
+
+    cursor = offset + size;
+    return static_cast<uint32_t>(offset);
   }
 
-  void initVulkan()
+  template <typename T>
+  uint32_t push(const T &value)
   {
-    createInstance();
-    setupDebugMessenger();
-    createSurface();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createDescriptorSetLayout();
-    createGraphicsPipeline();
-    createCommandPool();
-    createDepthResources();
-    createFramebuffers();
-    createTextureImage();
-    createTextureImageView();
-    createTextureSampler();
-    loadModel();
-    createVertexBuffer();
-    createIndexBuffer();
-    createUniformBuffers();
-    createDescriptorPool();
-    createDescriptorSets();
-    createCommandBuffers();
-    createSyncObjects();
+    uint32_t offset = allocate(sizeof(T));
+    memcpy(mapped + offset, &value, sizeof(T));
+    return offset;
   }
 
-  void mainLoop()
+private:
+  char *mapped = nullptr;
+  VkDeviceSize alignment = 1;
+  VkDeviceSize regionSize = 0;
+  VkDeviceSize regionStart = 0;
+  VkDeviceSize cursor = 0;
+};
+
+// First memory type allowed by `typeFilter` that has all of `properties`.
+uint32_t findMemoryTypeIndex(const VkPhysicalDeviceMemoryProperties &memoryProperties, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
   {
-    while (!glfwWindowShouldClose(window))
+    if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
     {
-      glfwPollEvents();
-      drawFrame();
+      return i;
     }
+  }
 
-    vkDeviceWaitIdle(device);
+  throw std::runtime_error("failed to find suitable memory type!");
+}
+
+struct Allocation
+{
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr;
+
+  uint32_t memoryTypeIndex = 0;
+  uint32_t order = 0;
+  bool linear = false;
+  bool dedicated = false;
+};
+
+struct AllocatorStatistics
+{
+  uint32_t deviceMemoryCount = 0;
+  uint32_t blockCount = 0;
+  uint32_t dedicatedCount = 0;
+  uint32_t allocationCount = 0;
+  VkDeviceSize bytesInUse = 0;
+  VkDeviceSize bytesReserved = 0;
+  VkDeviceSize blockBytes = 0;
+  VkDeviceSize dedicatedBytes = 0;
+  VkDeviceSize freeBytes = 0;
+  VkDeviceSize largestFreeRange = 0;
+
+  // Share of reserved bytes lost to power-of-two rounding.
+  double internalFragmentation() const
+  {
+    return bytesReserved == 0 ? 0.0 : 1.0 - static_cast<double>(bytesInUse) / bytesReserved;
   }
 
-  void cleanupSwapChain()
+  // Share of free block bytes not usable by the largest possible request.
+  double externalFragmentation() const
   {
-    vkDestroyImageView(device, depthImageView, nullptr);
-    vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+    return freeBytes == 0 ? 0.0 : 1.0 - static_cast<double>(largestFreeRange) / freeBytes;
+  }
+};
 
-    for (auto framebuffer : swapChainFramebuffers)
+// Sub-allocates device memory out of large blocks, one pool per memory type
+// and resource kind (linear buffers vs. optimally tiled images, so
+// bufferImageGranularity never has to be considered). Each block is managed
+// as a buddy system; host-visible blocks stay persistently mapped.
+class DeviceAllocator
+{
+public:
+  static constexpr VkDeviceSize MIN_NODE_SIZE = 256;
+  static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device)
+  {
+    this->device = device;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+    for (auto &pool : pools)
     {
-      vkDestroyFramebuffer(device, framebuffer, nullptr);
+      pool.resize(memoryProperties.memoryTypeCount);
     }
+  }
 
-    for (auto imageView : swapChainImageViews)
+  void destroy()
+  {
+    for (auto &pool : pools)
     {
-      vkDestroyImageView(device, imageView, nullptr);
+      for (auto &blocks : pool)
+      {
+        for (auto &block : blocks)
+        {
+          vkFreeMemory(device, block->memory, nullptr);
+        }
+        blocks.clear();
+      }
     }
 
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    if (stats.dedicatedCount > 0)
+    {
+      std::cerr << "device allocator: " << stats.dedicatedCount << " dedicated allocations leaked" << std::endl;
+    }
   }
 
-  void cleanup()
+  Allocation allocate(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, bool linear)
   {
-    cleanupSwapChain();
+    VkDeviceSize blockSize = blockSizeFor(memoryTypeIndex);
 
-    vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    vkDestroyRenderPass(device, renderPass, nullptr);
+    Allocation allocation{};
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.size = requirements.size;
+    allocation.linear = linear;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    // Large images (render targets, big textures) and anything that would
+    // occupy most of a block get their own VkDeviceMemory.
+    VkDeviceSize dedicatedThreshold = linear ? blockSize / 2 : blockSize / 4;
+    if (requirements.size > dedicatedThreshold || requirements.alignment > blockSize)
     {
-      vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-      vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-    }
-
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+      allocation.dedicated = true;
+      allocation.memory = allocateDeviceMemory(requirements.size, memoryTypeIndex, &allocation.mapped);
 
-    vkDestroySampler(device, textureSampler, nullptr);
-    vkDestroyImageView(device, textureImageView, nullptr);
+      stats.dedicatedCount++;
+      stats.dedicatedBytes += requirements.size;
+      stats.bytesInUse += requirements.size;
+      stats.bytesReserved += requirements.size;
+      stats.allocationCount++;
 
-    vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+      return allocation;
+    }
 
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    allocation.order = orderFor(std::max(requirements.size, requirements.alignment));
+
+    auto &blocks = pools[linear ? 1 : 0][memoryTypeIndex];
+    for (auto &block : blocks)
+    {
+      if (block->allocate(allocation.order, allocation.offset))
+      {
+        bindToBlock(allocation, *block);
+        return allocation;
+      }
+    }
+
+    auto block = std::make_unique<BuddyBlock>(blockSize, orderFor(blockSize));
+    block->memory = allocateDeviceMemory(blockSize, memoryTypeIndex, &block->mapped);
+    stats.blockCount++;
+    stats.blockBytes += blockSize;
+
+    block->allocate(allocation.order, allocation.offset);
+    bindToBlock(allocation, *block);
+    blocks.push_back(std::move(block));
+
+    return allocation;
+  }
+
+  void free(Allocation &allocation)
+  {
+    if (allocation.memory == VK_NULL_HANDLE)
+      return;
+
+    stats.allocationCount--;
+    stats.bytesInUse -= allocation.size;
+
+    if (allocation.dedicated)
+    {
+      vkFreeMemory(device, allocation.memory, nullptr);
+      stats.deviceMemoryCount--;
+      stats.dedicatedCount--;
+      stats.dedicatedBytes -= allocation.size;
+      stats.bytesReserved -= allocation.size;
+      allocation = Allocation{};
+      return;
+    }
+
+    stats.bytesReserved -= nodeSize(allocation.order);
+
+    auto &blocks = pools[allocation.linear ? 1 : 0][allocation.memoryTypeIndex];
+    auto it = std::find_if(blocks.begin(), blocks.end(), [&](const std::unique_ptr<BuddyBlock> &block)
+                           { return block->memory == allocation.memory; });
+    if (it == blocks.end())
+    {
+      throw std::invalid_argument("allocation does not belong to this allocator!");
+    }
+
+    BuddyBlock &block = **it;
+    block.free(allocation.order, allocation.offset);
+
+    // Keep one empty block per pool around so that transient staging
+    // allocations do not hit vkAllocateMemory every time.
+    if (block.allocationCount == 0)
+    {
+      size_t emptyBlocks = std::count_if(blocks.begin(), blocks.end(), [](const std::unique_ptr<BuddyBlock> &other)
+                                         { return other->allocationCount == 0; });
+      if (emptyBlocks > 1)
+      {
+        vkFreeMemory(device, block.memory, nullptr);
+        stats.deviceMemoryCount--;
+        stats.blockCount--;
+        stats.blockBytes -= block.size;
+        blocks.erase(it);
+      }
+    }
+
+    allocation = Allocation{};
+  }
+
+  AllocatorStatistics statistics() const
+  {
+    AllocatorStatistics result = stats;
+    result.freeBytes = 0;
+    result.largestFreeRange = 0;
+
+    for (const auto &pool : pools)
+    {
+      for (const auto &blocks : pool)
+      {
+        for (const auto &block : blocks)
+        {
+          for (uint32_t order = 0; order < block->freeLists.size(); order++)
+          {
+            if (!block->freeLists[order].empty())
+            {
+              result.freeBytes += block->freeLists[order].size() * nodeSize(order);
+              result.largestFreeRange = std::max(result.largestFreeRange, nodeSize(order));
+            }
+          }
+        }
+      }
+    }
+
+    return result;
+  }
+
+private:
+  struct BuddyBlock
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void *mapped = nullptr;
+    VkDeviceSize size;
+    uint32_t allocationCount = 0;
+
+    // Free node offsets for each order; node size is MIN_NODE_SIZE << order.
+    std::vector<std::set<VkDeviceSize>> freeLists;
+
+    BuddyBlock(VkDeviceSize size, uint32_t maxOrder) : size(size), freeLists(maxOrder + 1)
+    {
+      freeLists[maxOrder].insert(0);
+    }
+
+    bool allocate(uint32_t order, VkDeviceSize &offset)
+    {
+      uint32_t available = order;
+      while (available < freeLists.size() && freeLists[available].empty())
+      {
+        available++;
+      }
+
+      if (available == freeLists.size())
+      {
+        return false;
+      }
+
+      offset = *freeLists[available].begin();
+      freeLists[available].erase(freeLists[available].begin());
+
+      while (available > order)
+      {
+        available--;
+        freeLists[available].insert(offset + nodeSize(available));
+      }
+
+      allocationCount++;
+      return true;
+    }
+
+    void free(uint32_t order, VkDeviceSize offset)
+    {
+      while (order + 1 < freeLists.size())
+      {
+        auto buddy = freeLists[order].find(offset ^ nodeSize(order));
+        if (buddy == freeLists[order].end())
+        {
+          break;
+        }
+
+        offset = std::min(offset, *buddy);
+        freeLists[order].erase(buddy);
+        order++;
+      }
+
+      freeLists[order].insert(offset);
+      allocationCount--;
+    }
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+  uint32_t maxMemoryAllocationCount = 0;
+
+  // pools[0] holds optimally tiled images, pools[1] buffers and linear images.
+  std::array<std::vector<std::vector<std::unique_ptr<BuddyBlock>>>, 2> pools;
+  AllocatorStatistics stats;
+
+  static VkDeviceSize nodeSize(uint32_t order)
+  {
+    return MIN_NODE_SIZE << order;
+  }
+
+  static uint32_t orderFor(VkDeviceSize size)
+  {
+    uint32_t order = 0;
+    while (nodeSize(order) < size)
+    {
+      order++;
+    }
+    return order;
+  }
+
+  VkDeviceSize blockSizeFor(uint32_t memoryTypeIndex) const
+  {
+    // Small heaps (e.g. a 256 MiB host-visible BAR window) get smaller blocks.
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+    while (blockSize > MIN_NODE_SIZE && blockSize > heapSize / 8)
+    {
+      blockSize /= 2;
+    }
+    return blockSize;
+  }
+
+  void bindToBlock(Allocation &allocation, BuddyBlock &block)
+  {
+    allocation.memory = block.memory;
+    allocation.mapped = block.mapped != nullptr ? static_cast<char *>(block.mapped) + allocation.offset : nullptr;
+
+    stats.allocationCount++;
+    stats.bytesInUse += allocation.size;
+    stats.bytesReserved += nodeSize(allocation.order);
+  }
+
+  VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void **mapped)
+  {
+    if (stats.deviceMemoryCount >= maxMemoryAllocationCount)
+    {
+      throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+    }
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to allocate device memory!");
+    }
+    stats.deviceMemoryCount++;
+
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+      vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+    }
+
+    return memory;
+  }
+};
+
+// Halves an RGBA8 image with a 2x2 box filter, rounding to nearest. An odd
+// last row is paired with itself for every column; the vector loop only
+// takes whole column pairs and leaves an odd last column to the scalar one,
+// which rounds the same way.
+void downsampleRgba8(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight, uint8_t *dst)
+{
+  uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+  uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+
+  for (uint32_t y = 0; y < dstHeight; y++)
+  {
+    const uint8_t *row0 = src + static_cast<size_t>(std::min(2 * y, srcHeight - 1)) * srcWidth * 4;
+    const uint8_t *row1 = src + static_cast<size_t>(std::min(2 * y + 1, srcHeight - 1)) * srcWidth * 4;
+    uint8_t *out = dst + static_cast<size_t>(y) * dstWidth * 4;
+
+    uint32_t x = 0;
+#ifdef VULKAN_CUBES_SSE2
+    // Four output texels per iteration from eight texels of each row.
+    for (; 2 * x + 8 <= srcWidth; x += 4)
+    {
+      __m128i top0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 8 * x));
+      __m128i top1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 8 * x + 16));
+      __m128i bottom0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 8 * x));
+      __m128i bottom1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 8 * x + 16));
+
+      // Sums in 16 bits so that (a + b + c + d + 2) / 4 rounds once, as the
+      // scalar loop does; chained byte averages would round up twice.
+      __m128i zero = _mm_setzero_si128();
+      __m128i vertical01 = _mm_add_epi16(_mm_unpacklo_epi8(top0, zero), _mm_unpacklo_epi8(bottom0, zero));
+      __m128i vertical23 = _mm_add_epi16(_mm_unpackhi_epi8(top0, zero), _mm_unpackhi_epi8(bottom0, zero));
+      __m128i vertical45 = _mm_add_epi16(_mm_unpacklo_epi8(top1, zero), _mm_unpacklo_epi8(bottom1, zero));
+      __m128i vertical67 = _mm_add_epi16(_mm_unpackhi_epi8(top1, zero), _mm_unpackhi_epi8(bottom1, zero));
+
+      __m128i rounding = _mm_set1_epi16(2);
+      __m128i sum01 = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi64(vertical01, vertical23), _mm_unpackhi_epi64(vertical01, vertical23)), rounding);
+      __m128i sum23 = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi64(vertical45, vertical67), _mm_unpackhi_epi64(vertical45, vertical67)), rounding);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4 * x), _mm_packus_epi16(_mm_srli_epi16(sum01, 2), _mm_srli_epi16(sum23, 2)));
+    }
+#endif
+    for (; x < dstWidth; x++)
+    {
+      uint32_t x0 = std::min(2 * x, srcWidth - 1) * 4;
+      uint32_t x1 = std::min(2 * x + 1, srcWidth - 1) * 4;
+      for (uint32_t c = 0; c < 4; c++)
+      {
+        out[4 * x + c] = static_cast<uint8_t>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+      }
+    }
+  }
+}
+
+// Staged uploads recorded into batches on a transfer queue. Staging memory
+// comes from a persistently mapped ring that is reclaimed as batches retire,
+// and every submitted batch signals the next value of a timeline semaphore.
+//
+// Resources written on a different queue family are released by the batch
+// and have to be acquired on the graphics queue: recordGraphicsWork()
+// records the acquire barriers (plus any follow-up work such as mip blits)
+// and returns the timeline value that submission must wait for.
+class UploadEngine
+{
+public:
+  static constexpr VkDeviceSize DEFAULT_RING_SIZE = 32 * 1024 * 1024;
+
+  // Where a staged upload's source data lives; `data` is mapped memory.
+  struct StagingSpan
+  {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data;
+  };
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, DeviceAllocator &allocator, uint32_t transferFamily, uint32_t graphicsFamily)
+  {
+    this->device = device;
+    this->allocator = &allocator;
+    this->transferFamily = transferFamily;
+    this->graphicsFamily = graphicsFamily;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    alignment = std::max<VkDeviceSize>(16, properties.limits.optimalBufferCopyOffsetAlignment);
+
+    vkGetDeviceQueue(device, transferFamily, 0, &queue);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = transferFamily;
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create transfer command pool!");
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create upload timeline semaphore!");
+    }
+
+    createStagingBuffer(DEFAULT_RING_SIZE, ringBuffer, ringAllocation);
+    ringSize = DEFAULT_RING_SIZE;
+  }
+
+  void destroy()
+  {
+    flush();
+    wait(submittedValue);
+    retire();
+
+    vkDestroyBuffer(device, ringBuffer, nullptr);
+    allocator->free(ringAllocation);
+
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+  }
+
+  bool ownershipTransfers() const
+  {
+    return transferFamily != graphicsFamily;
+  }
+
+  uint32_t queueFamily() const
+  {
+    return transferFamily;
+  }
+
+  // Reserves `size` bytes of staging memory. The caller fills `data` and then
+  // records exactly one copy from it before staging anything else.
+  StagingSpan stage(VkDeviceSize size)
+  {
+    if (size > ringSize)
+    {
+      // Too large for the ring: give it a buffer of its own that lives as
+      // long as the batch.
+      TemporaryBuffer temporary;
+      createStagingBuffer(size, temporary.buffer, temporary.allocation);
+      openBatch().temporaryBuffers.push_back(temporary);
+      return {temporary.buffer, 0, temporary.allocation.mapped};
+    }
+
+    while (true)
+    {
+      VkDeviceSize start = (ringHead + alignment - 1) / alignment * alignment;
+      if (start % ringSize + size > ringSize)
+      {
+        start = (start / ringSize + 1) * ringSize;
+      }
+
+      if (start + size - ringTail <= ringSize)
+      {
+        ringHead = start + size;
+        openBatch();
+        return {ringBuffer, start % ringSize, static_cast<char *>(ringAllocation.mapped) + start % ringSize};
+      }
+
+      // The ring is full: push out what is pending and wait for the oldest
+      // batch to give its space back.
+      flush();
+      if (inFlight.empty())
+      {
+        // Everything has retired, only the wrap-around gap was in the way.
+        ringHead = ringTail = (ringHead + ringSize - 1) / ringSize * ringSize;
+        continue;
+      }
+      wait(inFlight.front().value);
+      retire();
+    }
+  }
+
+  // Copies a staged span into `dst` for use at `dstStage`/`dstAccess` on the
+  // graphics queue. Buffers created with concurrent sharing pass
+  // `exclusive = false` and skip the ownership transfer.
+  void copyToBuffer(const StagingSpan &span, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, bool exclusive)
+  {
+    Batch &batch = openBatch();
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = span.offset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(batch.commandBuffer, span.buffer, dst, 1, &copyRegion);
+
+    if (!exclusive || !ownershipTransfers())
+      return;
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = graphicsFamily;
+    barrier.buffer = dst;
+    barrier.offset = dstOffset;
+    barrier.size = size;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccess;
+    batch.graphicsWork.bufferBarriers.push_back(barrier);
+    batch.graphicsWork.dstStages |= dstStage;
+  }
+
+  // Copies `regions` (buffer offsets relative to the span) into `image`,
+  // moving `range` from UNDEFINED to `finalLayout` for use at
+  // `dstStage`/`dstAccess` on the graphics queue.
+  void copyToImage(const StagingSpan &span, VkImage image, const VkImageSubresourceRange &range, std::vector<VkBufferImageCopy> regions, VkImageLayout finalLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+  {
+    Batch &batch = openBatch();
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    for (auto &region : regions)
+    {
+      region.bufferOffset += span.offset;
+    }
+    vkCmdCopyBufferToImage(batch.commandBuffer, span.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+    // Without an ownership transfer this is a plain layout transition; the
+    // timeline wait on the graphics queue makes the writes visible.
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    if (ownershipTransfers())
+    {
+      barrier.srcQueueFamilyIndex = transferFamily;
+      barrier.dstQueueFamilyIndex = graphicsFamily;
+    }
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    if (!ownershipTransfers())
+      return;
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccess;
+    batch.graphicsWork.imageBarriers.push_back(barrier);
+    batch.graphicsWork.dstStages |= dstStage;
+  }
+
+  // Records `record` on the graphics queue once the current batch's
+  // resources are owned there.
+  void onGraphicsQueue(std::function<void(VkCommandBuffer)> record)
+  {
+    openBatch().graphicsWork.callbacks.push_back(std::move(record));
+  }
+
+  // Submits the open batch, if any, and returns the timeline value it will
+  // signal (or the last submitted value when there was nothing to do).
+  uint64_t flush()
+  {
+    if (!batchOpen)
+      return submittedValue;
+
+    Batch batch = std::move(currentBatch);
+    currentBatch = Batch{};
+    batchOpen = false;
+
+    vkEndCommandBuffer(batch.commandBuffer);
+
+    batch.value = ++submittedValue;
+    batch.ringEnd = ringHead;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &batch.value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &timeline;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to submit upload batch!");
+    }
+
+    batch.graphicsWork.value = batch.value;
+    pendingGraphicsWork.push_back(std::move(batch.graphicsWork));
+    inFlight.push_back(std::move(batch));
+
+    return submittedValue;
+  }
+
+  // Records acquire barriers and follow-up work for every submitted batch
+  // into a graphics command buffer. Returns the timeline value the
+  // submission has to wait for, or 0 if nothing was recorded.
+  uint64_t recordGraphicsWork(VkCommandBuffer commandBuffer)
+  {
+    retire();
+
+    uint64_t waitValue = 0;
+    for (auto &work : pendingGraphicsWork)
+    {
+      if (!work.bufferBarriers.empty() || !work.imageBarriers.empty())
+      {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, work.dstStages, 0,
+                             0, nullptr,
+                             static_cast<uint32_t>(work.bufferBarriers.size()), work.bufferBarriers.data(),
+                             static_cast<uint32_t>(work.imageBarriers.size()), work.imageBarriers.data());
+      }
+
+      for (auto &record : work.callbacks)
+      {
+        record(commandBuffer);
+      }
+
+      waitValue = std::max(waitValue, work.value);
+    }
+    pendingGraphicsWork.clear();
+
+    return waitValue;
+  }
+
+  bool hasGraphicsWork() const
+  {
+    return !pendingGraphicsWork.empty();
+  }
+
+  VkSemaphore semaphore() const
+  {
+    return timeline;
+  }
+
+  void wait(uint64_t value)
+  {
+    if (value == 0)
+      return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+  }
+
+private:
+  struct TemporaryBuffer
+  {
+    VkBuffer buffer;
+    Allocation allocation;
+  };
+
+  struct GraphicsWork
+  {
+    uint64_t value = 0;
+    VkPipelineStageFlags dstStages = 0;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<std::function<void(VkCommandBuffer)>> callbacks;
+  };
+
+  struct Batch
+  {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    uint64_t value = 0;
+    VkDeviceSize ringEnd = 0;
+    std::vector<TemporaryBuffer> temporaryBuffers;
+    GraphicsWork graphicsWork;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+  uint32_t transferFamily = 0;
+  uint32_t graphicsFamily = 0;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkSemaphore timeline = VK_NULL_HANDLE;
+  uint64_t submittedValue = 0;
+
+  // Ring positions grow monotonically; the offset into the buffer is the
+  // position modulo ringSize. [ringTail, ringHead) is still in use.
+  VkBuffer ringBuffer = VK_NULL_HANDLE;
+  Allocation ringAllocation;
+  VkDeviceSize ringSize = 0;
+  VkDeviceSize ringHead = 0;
+  VkDeviceSize ringTail = 0;
+  VkDeviceSize alignment = 16;
+
+  Batch currentBatch;
+  bool batchOpen = false;
+  std::deque<Batch> inFlight;
+  std::vector<VkCommandBuffer> freeCommandBuffers;
+  std::vector<GraphicsWork> pendingGraphicsWork;
+
+  Batch &openBatch()
+  {
+    if (batchOpen)
+      return currentBatch;
+
+    if (freeCommandBuffers.empty())
+    {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = commandPool;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
+
+      VkCommandBuffer commandBuffer;
+      if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to allocate upload command buffer!");
+      }
+      freeCommandBuffers.push_back(commandBuffer);
+    }
+
+    currentBatch.commandBuffer = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+    batchOpen = true;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkResetCommandBuffer(currentBatch.commandBuffer, 0);
+    vkBeginCommandBuffer(currentBatch.commandBuffer, &beginInfo);
+
+    return currentBatch;
+  }
+
+  // Gives back the staging space and command buffers of completed batches.
+  void retire()
+  {
+    uint64_t completedValue = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &completedValue);
+
+    while (!inFlight.empty() && inFlight.front().value <= completedValue)
+    {
+      Batch &batch = inFlight.front();
+      ringTail = batch.ringEnd;
+      freeCommandBuffers.push_back(batch.commandBuffer);
+      for (auto &temporary : batch.temporaryBuffers)
+      {
+        vkDestroyBuffer(device, temporary.buffer, nullptr);
+        allocator->free(temporary.allocation);
+      }
+      inFlight.pop_front();
+    }
+  }
+
+  void createStagingBuffer(VkDeviceSize size, VkBuffer &buffer, Allocation &allocation)
+  {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create staging buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    uint32_t memoryTypeIndex = findMemoryTypeIndex(memoryProperties, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    allocation = allocator->allocate(memRequirements, memoryTypeIndex, true);
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+  }
+};
+
+// Block dimensions and size for the compressed formats we accept, or false.
+bool compressedBlockInfo(VkFormat format, uint32_t &blockWidth, uint32_t &blockHeight, uint32_t &blockBytes)
+{
+  blockWidth = 4;
+  blockHeight = 4;
+
+  switch (format)
+  {
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    blockBytes = 8;
+    return true;
+  case VK_FORMAT_BC3_UNORM_BLOCK:
+  case VK_FORMAT_BC3_SRGB_BLOCK:
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+  case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+  case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+    blockBytes = 16;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// A KTX2 texture without supercompression. `data` holds the whole file and
+// levels index into it, largest level first.
+struct Ktx2Texture
+{
+  struct Level
+  {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  std::vector<Level> levels;
+  std::vector<char> data;
+};
+
+Ktx2Texture parseKtx2(std::vector<char> data)
+{
+  static const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+  const size_t headerSize = sizeof(identifier) + 9 * sizeof(uint32_t) + 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+  if (data.size() < headerSize || memcmp(data.data(), identifier, sizeof(identifier)) != 0)
+  {
+    throw std::runtime_error("not a KTX2 file!");
+  }
+
+  auto readU32 = [&](size_t offset)
+  {
+    uint32_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+  };
+  auto readU64 = [&](size_t offset)
+  {
+    uint64_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return value;
+  };
+
+  Ktx2Texture texture;
+  texture.format = static_cast<VkFormat>(readU32(12));
+  texture.width = readU32(20);
+  texture.height = readU32(24);
+  uint32_t depth = readU32(28);
+  uint32_t layerCount = readU32(32);
+  uint32_t faceCount = readU32(36);
+  uint32_t levelCount = std::max(readU32(40), 1u);
+  uint32_t supercompressionScheme = readU32(44);
+
+  if (depth > 1 || layerCount > 1 || faceCount != 1 || texture.width == 0 || texture.height == 0)
+  {
+    throw std::runtime_error("only 2D KTX2 textures are supported!");
+  }
+  if (supercompressionScheme != 0)
+  {
+    throw std::runtime_error("supercompressed KTX2 textures are not supported!");
+  }
+
+  uint32_t blockWidth, blockHeight, blockBytes;
+  if (!compressedBlockInfo(texture.format, blockWidth, blockHeight, blockBytes))
+  {
+    throw std::runtime_error("unsupported KTX2 format!");
+  }
+
+  uint32_t fullChainLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texture.width, texture.height)))) + 1;
+  if (levelCount > fullChainLevels)
+  {
+    throw std::runtime_error("too many KTX2 mip levels!");
+  }
+
+  if (data.size() < headerSize + levelCount * 3 * sizeof(uint64_t))
+  {
+    throw std::runtime_error("truncated KTX2 level index!");
+  }
+
+  for (uint32_t level = 0; level < levelCount; level++)
+  {
+    size_t entry = headerSize + level * 3 * sizeof(uint64_t);
+    Ktx2Texture::Level range{readU64(entry), readU64(entry + sizeof(uint64_t))};
+
+    uint64_t blocksWide = (std::max(texture.width >> level, 1u) + blockWidth - 1) / blockWidth;
+    uint64_t blocksHigh = (std::max(texture.height >> level, 1u) + blockHeight - 1) / blockHeight;
+    if (range.size != blocksWide * blocksHigh * blockBytes || range.offset > data.size() || range.size > data.size() - range.offset)
+    {
+      throw std::runtime_error("invalid KTX2 level!");
+    }
+
+    texture.levels.push_back(range);
+  }
+
+  texture.data = std::move(data);
+  return texture;
+}
+
+// RGBA8 pixels decoded by stb_image.
+struct DecodedImage
+{
+  std::unique_ptr<stbi_uc, void (*)(void *)> pixels{nullptr, stbi_image_free};
+  int width = 0;
+  int height = 0;
+};
+
+DecodedImage decodeImage(const std::string &path)
+{
+  DecodedImage image;
+  int channels;
+  image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height, &channels, STBI_rgb_alpha));
+  if (!image.pixels)
+  {
+    throw std::runtime_error("failed to load texture image!");
+  }
+  return image;
+}
+
+struct PipelineCacheStatistics
+{
+  size_t loadedBytes = 0;
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  // Pipelines created without VK_EXT_pipeline_creation_feedback.
+  uint32_t unknown = 0;
+  double hitMilliseconds = 0.0;
+  double missMilliseconds = 0.0;
+  double unknownMilliseconds = 0.0;
+};
+
+struct QueueFamilyIndices
+{
+  std::optional<uint32_t> graphicsFamily;
+  std::optional<uint32_t> presentFamily;
+  std::optional<uint32_t> transferFamily;
+
+  bool isComplete()
+  {
+    return graphicsFamily.has_value() && presentFamily.has_value();
+  }
+};
+
+// Swap chain resources replaced by a recreation. They are destroyed once
+// the frame timeline reaches the last submission made before retirement.
+struct RetiredSwapChain
+{
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+  std::vector<VkImageView> imageViews;
+  std::vector<VkFramebuffer> framebuffers;
+  std::vector<VkSemaphore> presentSemaphores;
+  std::vector<VkCommandBuffer> commandBuffers;
+  VkImage depthImage = VK_NULL_HANDLE;
+  VkImageView depthImageView = VK_NULL_HANDLE;
+  Allocation depthImageAllocation;
+  uint64_t lastSubmission = 0;
+};
+
+struct SwapChainSupportDetails
+{
+  VkSurfaceCapabilitiesKHR capabilities;
+  std::vector<VkSurfaceFormatKHR> formats;
+  std::vector<VkPresentModeKHR> presentModes;
+};
+
+// A material texture of the bindless array other than textureImage. Those
+// that failed to decode have no image and bind textureImage instead.
+struct MaterialTexture
+{
+  VkImage image = VK_NULL_HANDLE;
+  Allocation allocation;
+  VkImageView view = VK_NULL_HANDLE;
+};
+
+// Per-instance data, fed through vertex binding 1 at instance rate.
+struct InstanceData
+{
+  glm::mat4 model;
+};
+
+// Vertex as loaded and deduplicated on the CPU; see PackedVertex for what
+// the GPU reads.
+struct Vertex
+{
+  glm::vec3 pos;
+  glm::vec3 normal;
+  glm::vec2 texCoord;
+  // Element of the bindless material array, from the face's OBJ material.
+  uint32_t material = 0;
+
+  bool operator==(const Vertex &other) const
+  {
+    return pos == other.pos && normal == other.normal && texCoord == other.texCoord && material == other.material;
+  }
+};
+
+// Maps a unit vector onto the [-1, 1] square: the upper hemisphere of an
+// octahedron unfolds into the inner diamond, the lower one into the corners.
+glm::vec2 encodeOctahedral(glm::vec3 normal)
+{
+  float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (length == 0.0f)
+  {
+    return glm::vec2(0.0f, 0.0f);
+  }
+
+  glm::vec2 encoded = glm::vec2(normal.x, normal.y) / length;
+  if (normal.z < 0.0f)
+  {
+    glm::vec2 signs(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+    encoded = (glm::vec2(1.0f) - glm::vec2(std::abs(encoded.y), std::abs(encoded.x))) * signs;
+  }
+  return encoded;
+}
+
+// Push constants of shader.vert: position = offset + unorm position * scale.
+struct VertexDequantization
+{
+  glm::vec4 offset;
+  glm::vec4 scale;
+};
+
+// The vertex layout the GPU reads, 16 bytes against the 36 of Vertex.
+// Positions are unorm16 within the bounds of their draw range, texture
+// coordinates half floats and the normal octahedral-encoded in snorm16. The
+// otherwise unused fourth position component carries the material.
+struct PackedVertex
+{
+  uint16_t position[4];
+  uint32_t texCoord;
+  uint32_t normal;
+
+  static std::array<VkVertexInputBindingDescription, 2> getBindingDescriptions()
+  {
+    std::array<VkVertexInputBindingDescription, 2> bindingDescriptions{};
+
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(PackedVertex);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = sizeof(InstanceData);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    return bindingDescriptions;
+  }
+
+  static std::array<VkVertexInputAttributeDescription, 7> getAttributeDescriptions()
+  {
+    std::array<VkVertexInputAttributeDescription, 7> attributeDescriptions{};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+    attributeDescriptions[0].offset = offsetof(PackedVertex, position);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(PackedVertex, texCoord);
+
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R16G16_SNORM;
+    attributeDescriptions[2].offset = offsetof(PackedVertex, normal);
+
+    // A mat4 attribute takes one location per column.
+    for (uint32_t column = 0; column < 4; column++)
+    {
+      attributeDescriptions[3 + column].binding = 1;
+      attributeDescriptions[3 + column].location = 3 + column;
+      attributeDescriptions[3 + column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+      attributeDescriptions[3 + column].offset = offsetof(InstanceData, model) + column * sizeof(glm::vec4);
+    }
+
+    return attributeDescriptions;
+  }
+};
+
+// Quantizes `vertices` against their own bounding box and returns what the
+// vertex shader needs to undo it.
+VertexDequantization packVertices(const std::vector<Vertex> &vertices, std::vector<PackedVertex> &packed)
+{
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+  for (const auto &vertex : vertices)
+  {
+    boundsMin = glm::min(boundsMin, vertex.pos);
+    boundsMax = glm::max(boundsMax, vertex.pos);
+  }
+
+  glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(std::numeric_limits<float>::min()));
+
+  packed.resize(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++)
+  {
+    glm::vec3 position = glm::clamp((vertices[i].pos - boundsMin) / extent, 0.0f, 1.0f);
+    packed[i].position[0] = static_cast<uint16_t>(position.x * 65535.0f + 0.5f);
+    packed[i].position[1] = static_cast<uint16_t>(position.y * 65535.0f + 0.5f);
+    packed[i].position[2] = static_cast<uint16_t>(position.z * 65535.0f + 0.5f);
+    packed[i].position[3] = static_cast<uint16_t>(vertices[i].material);
+    packed[i].texCoord = glm::packHalf2x16(vertices[i].texCoord);
+    packed[i].normal = glm::packSnorm2x16(encodeOctahedral(vertices[i].normal));
+  }
+
+  return {glm::vec4(boundsMin, 0.0f), glm::vec4(extent, 0.0f)};
+}
+
+// Mixes every attribute bit into a 64-bit hash. Zero is normalized so that
+// -0.0f and 0.0f, which compare equal, also hash equal.
+uint64_t hashVertex(const Vertex &vertex)
+{
+  const float components[] = {
+      vertex.pos.x, vertex.pos.y, vertex.pos.z,
+      vertex.normal.x, vertex.normal.y, vertex.normal.z,
+      vertex.texCoord.x, vertex.texCoord.y};
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (float component : components)
+  {
+    uint32_t bits = 0;
+    if (component != 0.0f)
+    {
+      memcpy(&bits, &component, sizeof(bits));
+    }
+
+    hash = (hash ^ bits) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 32;
+  }
+  hash = (hash ^ vertex.material) * 0x9e3779b97f4a7c15ull;
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Open-addressing (linear probing) table mapping vertices to their index in
+// an external vertex array. Slots only hold the index and the upper hash
+// bits, so a probe touches 8 bytes per slot and rarely dereferences a vertex.
+class VertexDeduplicator
+{
+public:
+  explicit VertexDeduplicator(size_t expectedVertices)
+  {
+    size_t capacity = 16;
+    while (capacity < expectedVertices * 2)
+    {
+      capacity *= 2;
+    }
+    slots.resize(capacity);
+  }
+
+  // Returns the index of a vertex equal to `vertex`, appending it to
+  // `vertices` first if there is none yet.
+  uint32_t insert(const Vertex &vertex, uint64_t hash, std::vector<Vertex> &vertices)
+  {
+    if ((count + 1) * 2 > slots.size())
+    {
+      grow(vertices);
+    }
+
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+      Slot &entry = slots[slot];
+      if (entry.index == EMPTY)
+      {
+        entry.tag = tag;
+        entry.index = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(vertex);
+        count++;
+        return entry.index;
+      }
+
+      if (entry.tag == tag && vertices[entry.index] == vertex)
+      {
+        return entry.index;
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+  struct Slot
+  {
+    uint32_t tag = 0;
+    uint32_t index = EMPTY;
+  };
+
+  std::vector<Slot> slots;
+  size_t count = 0;
+
+  void grow(const std::vector<Vertex> &vertices)
+  {
+    std::vector<Slot> old = std::move(slots);
+    slots.assign(old.size() * 2, Slot{});
+
+    size_t mask = slots.size() - 1;
+    for (const Slot &entry : old)
+    {
+      if (entry.index == EMPTY)
+        continue;
+
+      size_t slot = hashVertex(vertices[entry.index]) & mask;
+      while (slots[slot].index != EMPTY)
+      {
+        slot = (slot + 1) & mask;
+      }
+      slots[slot] = entry;
+    }
+  }
+};
+
+class ThreadPool
+{
+public:
+  explicit ThreadPool(uint32_t threadCount)
+  {
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+      workers.emplace_back([this]
+                           { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    condition.notify_all();
+
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  uint32_t size() const
+  {
+    return static_cast<uint32_t>(workers.size());
+  }
+
+  std::future<void> submit(std::function<void()> task)
+  {
+    auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    std::future<void> future = packaged->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.emplace_back([packaged]
+                         { (*packaged)(); });
+    }
+    condition.notify_one();
+    return future;
+  }
+
+  // Runs `function(i)` for every i in [0, count) and waits for all of them,
+  // rethrowing the first exception.
+  void parallelFor(uint32_t count, const std::function<void(uint32_t)> &function)
+  {
+    std::vector<std::future<void>> futures;
+    futures.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      futures.push_back(submit([&function, i]
+                               { function(i); }));
+    }
+
+    for (auto &future : futures)
+    {
+      future.wait();
+    }
+    for (auto &future : futures)
+    {
+      future.get();
+    }
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+
+  void workerLoop()
+  {
+    while (true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]
+                       { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty())
+          return;
+
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+};
+
+// Runs the startup steps as a dependency graph. Steps added with add() run
+// on the thread calling run(), in the order they were added, each as soon
+// as its dependencies are done; steps added with addBackground() go to the
+// pool. The first exception stops scheduling and is rethrown by run() once
+// the running steps finish.
+class StartupGraph
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit StartupGraph(Clock::time_point origin) : origin(origin) {}
+
+  // Both return the step's id for the dependencies of later steps.
+  uint32_t add(const char *name, const std::vector<uint32_t> &dependencies, std::function<void()> function)
+  {
+    return addStep(name, dependencies, std::move(function), false);
+  }
+
+  uint32_t addBackground(const char *name, const std::vector<uint32_t> &dependencies, std::function<void()> function)
+  {
+    return addStep(name, dependencies, std::move(function), true);
+  }
+
+  void run(ThreadPool &pool)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    remaining = static_cast<uint32_t>(steps.size());
+    for (uint32_t id = 0; id < steps.size(); id++)
+    {
+      if (steps[id].pending == 0)
+      {
+        schedule(pool, id);
+      }
+    }
+
+    while (true)
+    {
+      condition.wait(lock, [this]
+                     { return remaining == 0 || (failure ? backgroundRunning == 0 : !ready.empty()); });
+      if (failure)
+        std::rethrow_exception(failure);
+      if (remaining == 0)
+        return;
+
+      uint32_t id = *ready.begin();
+      ready.erase(ready.begin());
+      lock.unlock();
+      std::exception_ptr error = execute(id);
+      lock.lock();
+      finish(pool, id, error);
+    }
+  }
+
+  // Prints every step's start and end in milliseconds since the origin,
+  // ordered by start, followed by `firstFrame`.
+  void writeTimeline(std::ostream &out, Clock::time_point firstFrame) const
+  {
+    std::vector<const Step *> order;
+    for (const auto &step : steps)
+    {
+      order.push_back(&step);
+    }
+    std::sort(order.begin(), order.end(), [](const Step *a, const Step *b)
+              { return a->start < b->start; });
+
+    out << "startup timeline (ms since launch):" << std::endl;
+    for (const Step *step : order)
+    {
+      out << "  " << milliseconds(step->start) << " - " << milliseconds(step->end) << " " << step->name
+          << (step->background ? " (worker)" : " (main)") << std::endl;
+    }
+    out << "  " << milliseconds(firstFrame) << " first frame" << std::endl;
+  }
+
+private:
+  struct Step
+  {
+    const char *name;
+    bool background;
+    std::function<void()> function;
+    std::vector<uint32_t> dependents;
+    size_t pending;
+    Clock::time_point start;
+    Clock::time_point end;
+  };
+
+  Clock::time_point origin;
+  std::vector<Step> steps;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  // Main thread steps whose dependencies are done, lowest id first.
+  std::set<uint32_t> ready;
+  uint32_t remaining = 0;
+  uint32_t backgroundRunning = 0;
+  std::exception_ptr failure;
+
+  uint32_t addStep(const char *name, const std::vector<uint32_t> &dependencies, std::function<void()> function, bool background)
+  {
+    uint32_t id = static_cast<uint32_t>(steps.size());
+    for (uint32_t dependency : dependencies)
+    {
+      steps[dependency].dependents.push_back(id);
+    }
+    steps.push_back({name, background, std::move(function), {}, dependencies.size(), {}, {}});
+    return id;
+  }
+
+  double milliseconds(Clock::time_point time) const
+  {
+    return std::chrono::duration<double, std::milli>(time - origin).count();
+  }
+
+  // Called with the mutex held.
+  void schedule(ThreadPool &pool, uint32_t id)
+  {
+    if (!steps[id].background)
+    {
+      ready.insert(id);
+      return;
+    }
+
+    backgroundRunning++;
+    pool.submit([this, &pool, id]
+                {
+                  std::exception_ptr error = execute(id);
+                  std::lock_guard<std::mutex> lock(mutex);
+                  backgroundRunning--;
+                  finish(pool, id, error); });
+  }
+
+  std::exception_ptr execute(uint32_t id)
+  {
+    Step &step = steps[id];
+    std::exception_ptr error;
+    step.start = Clock::now();
+    try
+    {
+      step.function();
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    step.end = Clock::now();
+    return error;
+  }
+
+  // Called with the mutex held.
+  void finish(ThreadPool &pool, uint32_t id, std::exception_ptr error)
+  {
+    if (error && !failure)
+    {
+      failure = error;
+    }
+    if (!failure)
+    {
+      remaining--;
+      for (uint32_t dependent : steps[id].dependents)
+      {
+        if (--steps[dependent].pending == 0)
+        {
+          schedule(pool, dependent);
+        }
+      }
+    }
+    condition.notify_all();
+  }
+};
+
+// Post-transform vertex cache behaviour of an index buffer under a FIFO
+// cache: ACMR is misses per triangle, ATVR misses per vertex (1.0 is ideal).
+struct VertexCacheStatistics
+{
+  size_t triangles = 0;
+  size_t vertices = 0;
+  size_t misses = 0;
+
+  double acmr() const
+  {
+    return triangles == 0 ? 0.0 : static_cast<double>(misses) / triangles;
+  }
+
+  double atvr() const
+  {
+    return vertices == 0 ? 0.0 : static_cast<double>(misses) / vertices;
+  }
+
+  void add(const VertexCacheStatistics &other)
+  {
+    triangles += other.triangles;
+    vertices += other.vertices;
+    misses += other.misses;
+  }
+};
+
+struct MeshOptimizationStatistics
+{
+  VertexCacheStatistics before;
+  VertexCacheStatistics after;
+
+  void add(const MeshOptimizationStatistics &other)
+  {
+    before.add(other.before);
+    after.add(other.after);
+  }
+};
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount)
+{
+  VertexCacheStatistics statistics;
+  statistics.triangles = indices.size() / 3;
+  statistics.vertices = vertexCount;
+
+  // A vertex is cached while fewer than VERTEX_CACHE_SIZE misses happened
+  // since its own miss.
+  std::vector<size_t> missTime(vertexCount, 0);
+  for (uint32_t index : indices)
+  {
+    if (missTime[index] == 0 || statistics.misses - missTime[index] + 1 > VERTEX_CACHE_SIZE)
+    {
+      statistics.misses++;
+      missTime[index] = statistics.misses;
+    }
+  }
+
+  return statistics;
+}
+
+// Reorders triangles for the post-transform cache with Tipsify (Sander,
+// Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw"). Returns the first triangle of every cluster, which
+// starts wherever the walk had to jump to a vertex that is likely uncached.
+std::vector<size_t> optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount)
+{
+  size_t triangleCount = indices.size() / 3;
+
+  // Triangles around each vertex, as offsets into adjacency.
+  std::vector<uint32_t> liveTriangles(vertexCount, 0);
+  for (uint32_t index : indices)
+  {
+    liveTriangles[index]++;
+  }
+  std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (size_t vertex = 0; vertex < vertexCount; vertex++)
+  {
+    adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + liveTriangles[vertex];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++)
+  {
+    adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  std::vector<size_t> clusters;
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<size_t> cacheTime(vertexCount, 0);
+  std::vector<uint32_t> deadEnds;
+  std::vector<uint32_t> candidates;
+  size_t time = VERTEX_CACHE_SIZE + 1;
+  size_t cursor = 0;
+
+  auto skipDeadEnd = [&]() -> int64_t
+  {
+    while (!deadEnds.empty())
+    {
+      uint32_t vertex = deadEnds.back();
+      deadEnds.pop_back();
+      if (liveTriangles[vertex] > 0)
+        return vertex;
+    }
+    for (; cursor < vertexCount; cursor++)
+    {
+      if (liveTriangles[cursor] > 0)
+        return static_cast<int64_t>(cursor);
+    }
+    return -1;
+  };
+
+  int64_t fanning = skipDeadEnd();
+  if (fanning >= 0)
+  {
+    clusters.push_back(0);
+  }
+
+  while (fanning >= 0)
+  {
+    candidates.clear();
+    for (size_t i = adjacencyOffsets[fanning]; i < adjacencyOffsets[fanning + 1]; i++)
+    {
+      uint32_t triangle = adjacency[i];
+      if (emitted[triangle])
+        continue;
+      emitted[triangle] = true;
+
+      for (size_t corner = 0; corner < 3; corner++)
+      {
+        uint32_t vertex = indices[3 * triangle + corner];
+        result.push_back(vertex);
+        deadEnds.push_back(vertex);
+        candidates.push_back(vertex);
+        liveTriangles[vertex]--;
+        if (time - cacheTime[vertex] > VERTEX_CACHE_SIZE)
+        {
+          cacheTime[vertex] = time++;
+        }
+      }
+    }
+
+    // Prefer the candidate that stays in the cache the longest while its
+    // remaining triangles are emitted.
+    int64_t next = -1;
+    int64_t bestPriority = -1;
+    for (uint32_t vertex : candidates)
+    {
+      if (liveTriangles[vertex] == 0)
+        continue;
+
+      int64_t priority = 0;
+      if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= VERTEX_CACHE_SIZE)
+      {
+        priority = static_cast<int64_t>(time - cacheTime[vertex]);
+      }
+      if (priority > bestPriority)
+      {
+        bestPriority = priority;
+        next = vertex;
+      }
+    }
+
+    if (next < 0)
+    {
+      next = skipDeadEnd();
+      if (next >= 0 && result.size() < indices.size())
+      {
+        clusters.push_back(result.size() / 3);
+      }
+    }
+    fanning = next;
+  }
+
+  indices = std::move(result);
+  return clusters;
+}
+
+// Sorts the clusters from optimizeVertexCache so that triangles facing
+// away from the mesh centre come first, which tends to draw occluders
+// before what they hide from any direction. The order is kept only if the
+// cache efficiency stays within OVERDRAW_ACMR_THRESHOLD.
+void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, const std::vector<size_t> &clusters)
+{
+  size_t triangleCount = indices.size() / 3;
+  if (clusters.size() < 2)
+    return;
+
+  glm::vec3 meshCentroid(0.0f);
+  for (const auto &vertex : vertices)
+  {
+    meshCentroid += vertex.pos;
+  }
+  meshCentroid /= static_cast<float>(std::max<size_t>(vertices.size(), 1));
+
+  std::vector<std::pair<float, size_t>> order(clusters.size());
+  for (size_t cluster = 0; cluster < clusters.size(); cluster++)
+  {
+    size_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangleCount;
+
+    glm::vec3 centroid(0.0f);
+    glm::vec3 normal(0.0f);
+    float area = 0.0f;
+    for (size_t triangle = clusters[cluster]; triangle < end; triangle++)
+    {
+      const glm::vec3 &a = vertices[indices[3 * triangle + 0]].pos;
+      const glm::vec3 &b = vertices[indices[3 * triangle + 1]].pos;
+      const glm::vec3 &c = vertices[indices[3 * triangle + 2]].pos;
+
+      // The cross product's length is twice the area, so it weights both.
+      glm::vec3 cross = glm::cross(b - a, c - a);
+      float weight = glm::length(cross);
+      centroid += (a + b + c) * (weight / 3.0f);
+      normal += cross;
+      area += weight;
+    }
+
+    float sortKey = 0.0f;
+    if (area > 0.0f && glm::length(normal) > 0.0f)
+    {
+      sortKey = glm::dot(centroid / area - meshCentroid, glm::normalize(normal));
+    }
+    order[cluster] = {sortKey, cluster};
+  }
+
+  std::stable_sort(order.begin(), order.end(), [](const auto &a, const auto &b)
+                   { return a.first > b.first; });
+
+  std::vector<uint32_t> sorted;
+  sorted.reserve(indices.size());
+  for (const auto &entry : order)
+  {
+    size_t end = entry.second + 1 < clusters.size() ? clusters[entry.second + 1] : triangleCount;
+    sorted.insert(sorted.end(), indices.begin() + 3 * clusters[entry.second], indices.begin() + 3 * end);
+  }
+
+  if (analyzeVertexCache(sorted, vertices.size()).acmr() <= analyzeVertexCache(indices, vertices.size()).acmr() * OVERDRAW_ACMR_THRESHOLD)
+  {
+    indices = std::move(sorted);
+  }
+}
+
+// Renumbers vertices in the order the index buffer first uses them, so that
+// vertex fetches walk memory forward, and drops unreferenced vertices.
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+  std::vector<uint32_t> remap(vertices.size(), std::numeric_limits<uint32_t>::max());
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+
+  for (uint32_t &index : indices)
+  {
+    if (remap[index] == std::numeric_limits<uint32_t>::max())
+    {
+      remap[index] = static_cast<uint32_t>(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  vertices = std::move(reordered);
+}
+
+// Runs the vertex cache, optional overdraw and vertex fetch passes over a
+// triangle list and measures the cache before and after.
+MeshOptimizationStatistics optimizeMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, bool reduceOverdraw)
+{
+  MeshOptimizationStatistics statistics;
+  statistics.before = analyzeVertexCache(indices, vertices.size());
+
+  std::vector<size_t> clusters = optimizeVertexCache(indices, vertices.size());
+  if (reduceOverdraw)
+  {
+    optimizeOverdraw(indices, vertices, clusters);
+  }
+  optimizeVertexFetch(vertices, indices);
+
+  statistics.after = analyzeVertexCache(indices, vertices.size());
+  return statistics;
+}
+
+// Symmetric 4x4 error quadric from Garland and Heckbert, "Surface
+// Simplification Using Quadric Error Metrics".
+struct Quadric
+{
+  double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+  static Quadric fromPlane(const glm::vec3 &normal, double d, double weight)
+  {
+    double a = normal.x, b = normal.y, c = normal.z;
+
+    Quadric quadric;
+    quadric.a2 = a * a * weight;
+    quadric.ab = a * b * weight;
+    quadric.ac = a * c * weight;
+    quadric.ad = a * d * weight;
+    quadric.b2 = b * b * weight;
+    quadric.bc = b * c * weight;
+    quadric.bd = b * d * weight;
+    quadric.c2 = c * c * weight;
+    quadric.cd = c * d * weight;
+    quadric.d2 = d * d * weight;
+    return quadric;
+  }
+
+  void add(const Quadric &other)
+  {
+    a2 += other.a2;
+    ab += other.ab;
+    ac += other.ac;
+    ad += other.ad;
+    b2 += other.b2;
+    bc += other.bc;
+    bd += other.bd;
+    c2 += other.c2;
+    cd += other.cd;
+    d2 += other.d2;
+  }
+
+  double error(const glm::vec3 &point) const
+  {
+    double x = point.x, y = point.y, z = point.z;
+    return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+           b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+           c2 * z * z + 2 * cd * z + d2;
+  }
+};
+
+// Collapses edges onto one of their endpoints, cheapest quadric error
+// first, until at most `targetTriangles` remain or nothing can collapse
+// without flipping a triangle. Vertices never move, so every level keeps
+// indexing the same vertex buffer. Vertices on open edges (which includes
+// streamed chunk borders) and on UV seams, where several vertices share a
+// position, are locked so that no cracks open up.
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex> &vertices, std::vector<uint32_t> indices, size_t targetTriangles)
+{
+  size_t vertexCount = vertices.size();
+  std::vector<bool> locked(vertexCount, false);
+
+  std::vector<uint32_t> byPosition(vertexCount);
+  for (uint32_t i = 0; i < vertexCount; i++)
+  {
+    byPosition[i] = i;
+  }
+  auto positionLess = [&](uint32_t a, uint32_t b)
+  {
+    const glm::vec3 &p = vertices[a].pos;
+    const glm::vec3 &q = vertices[b].pos;
+    return p.x != q.x ? p.x < q.x : (p.y != q.y ? p.y < q.y : p.z < q.z);
+  };
+  std::sort(byPosition.begin(), byPosition.end(), positionLess);
+  for (size_t i = 1; i < vertexCount; i++)
+  {
+    if (vertices[byPosition[i - 1]].pos == vertices[byPosition[i]].pos)
+    {
+      locked[byPosition[i - 1]] = locked[byPosition[i]] = true;
+    }
+  }
+
+  auto edgeKey = [](uint32_t a, uint32_t b)
+  {
+    return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+  };
+
+  std::vector<uint64_t> edges;
+  edges.reserve(indices.size());
+  for (size_t i = 0; i < indices.size(); i += 3)
+  {
+    for (size_t corner = 0; corner < 3; corner++)
+    {
+      edges.push_back(edgeKey(indices[i + corner], indices[i + (corner + 1) % 3]));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size();)
+  {
+    size_t end = i;
+    while (end < edges.size() && edges[end] == edges[i])
+    {
+      end++;
+    }
+    if (end - i == 1)
+    {
+      locked[edges[i] >> 32] = locked[edges[i] & 0xffffffffu] = true;
+    }
+    i = end;
+  }
+
+  std::vector<Quadric> quadrics(vertexCount);
+  for (size_t i = 0; i < indices.size(); i += 3)
+  {
+    const glm::vec3 &a = vertices[indices[i + 0]].pos;
+    const glm::vec3 &b = vertices[indices[i + 1]].pos;
+    const glm::vec3 &c = vertices[indices[i + 2]].pos;
+
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    float length = glm::length(normal);
+    if (length == 0.0f)
+      continue;
+
+    normal /= length;
+    Quadric quadric = Quadric::fromPlane(normal, -glm::dot(normal, a), length * 0.5);
+    for (size_t corner = 0; corner < 3; corner++)
+    {
+      quadrics[indices[i + corner]].add(quadric);
+    }
+  }
+
+  struct Collapse
+  {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+  };
+
+  // Every pass collapses edges whose neighbourhoods do not overlap, so that
+  // the adjacency and flip checks of a pass stay valid throughout it.
+  std::vector<uint32_t> remap(vertexCount);
+  while (indices.size() / 3 > targetTriangles)
+  {
+    std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (uint32_t index : indices)
+    {
+      adjacencyOffsets[index + 1]++;
+    }
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+      adjacencyOffsets[vertex + 1] += adjacencyOffsets[vertex];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    edges.clear();
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+      for (size_t corner = 0; corner < 3; corner++)
+      {
+        edges.push_back(edgeKey(indices[i + corner], indices[i + (corner + 1) % 3]));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    std::vector<Collapse> collapses;
+    collapses.reserve(2 * edges.size());
+    for (uint64_t edge : edges)
+    {
+      uint32_t a = static_cast<uint32_t>(edge >> 32);
+      uint32_t b = static_cast<uint32_t>(edge & 0xffffffffu);
+      Quadric combined = quadrics[a];
+      combined.add(quadrics[b]);
+
+      if (!locked[a])
+      {
+        collapses.push_back({combined.error(vertices[b].pos), a, b});
+      }
+      if (!locked[b])
+      {
+        collapses.push_back({combined.error(vertices[a].pos), b, a});
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y)
+              { return x.cost < y.cost; });
+
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+      remap[vertex] = vertex;
+    }
+    std::vector<bool> touched(vertexCount, false);
+    size_t triangleCount = indices.size() / 3;
+    size_t collapsed = 0;
+
+    for (const auto &collapse : collapses)
+    {
+      if (triangleCount <= targetTriangles)
+        break;
+      if (touched[collapse.from] || touched[collapse.to])
+        continue;
+
+      // Moving `from` onto `to` must not turn any surviving triangle over.
+      bool flips = false;
+      size_t removed = 0;
+      for (size_t i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1] && !flips; i++)
+      {
+        const uint32_t *triangle = &indices[3 * adjacency[i]];
+        if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+        {
+          removed++;
+          continue;
+        }
+
+        glm::vec3 corners[3];
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+          corners[corner] = vertices[triangle[corner]].pos;
+        }
+        glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+          if (triangle[corner] == collapse.from)
+          {
+            corners[corner] = vertices[collapse.to].pos;
+          }
+        }
+        glm::vec3 after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        flips = glm::dot(before, after) <= 0.0f;
+      }
+      if (flips)
+        continue;
+
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to].add(quadrics[collapse.from]);
+      for (size_t i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1]; i++)
+      {
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+          touched[indices[3 * adjacency[i] + corner]] = true;
+        }
+      }
+      triangleCount -= removed;
+      collapsed++;
+    }
+
+    if (collapsed == 0)
+      break;
+
+    std::vector<uint32_t> remaining;
+    remaining.reserve(3 * triangleCount);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+      uint32_t a = remap[indices[i + 0]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+      if (a != b && b != c && c != a)
+      {
+        remaining.insert(remaining.end(), {a, b, c});
+      }
+    }
+    indices = std::move(remaining);
+  }
+
+  return indices;
+}
+
+// What happens to every loaded triangle list before upload.
+struct MeshProcessing
+{
+  bool optimize = false;
+  bool reduceOverdraw = false;
+  uint32_t lodLevels = 1;
+};
+
+// Optimizes a triangle list in place and appends its simplified LODs to
+// `indices`. Returns the index count of every level, LOD 0 first.
+std::vector<uint32_t> processMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, const MeshProcessing &processing, MeshOptimizationStatistics &statistics)
+{
+  if (processing.optimize)
+  {
+    statistics = optimizeMesh(vertices, indices, processing.reduceOverdraw);
+  }
+
+  std::vector<uint32_t> lodIndexCounts = {static_cast<uint32_t>(indices.size())};
+  std::vector<uint32_t> level = indices;
+  for (uint32_t lod = 1; lod < processing.lodLevels; lod++)
+  {
+    std::vector<uint32_t> simplified = simplifyMesh(vertices, level, level.size() / 6);
+    // Stop once locked vertices keep a level from getting meaningfully smaller.
+    if (simplified.empty() || simplified.size() > level.size() * 9 / 10)
+      break;
+
+    if (processing.optimize)
+    {
+      optimizeVertexCache(simplified, vertices.size());
+    }
+    indices.insert(indices.end(), simplified.begin(), simplified.end());
+    lodIndexCounts.push_back(static_cast<uint32_t>(simplified.size()));
+    level = std::move(simplified);
+  }
+
+  return lodIndexCounts;
+}
+
+struct MeshChunk
+{
+  std::vector<Vertex> vertices;
+  // All LODs back to back; lodIndexCounts has the length of each.
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> lodIndexCounts;
+  MeshOptimizationStatistics optimization;
+
+  size_t bytes() const
+  {
+    return vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t);
+  }
+};
+
+// Concatenates chunks level by level so that they upload as one draw range
+// per LOD, quantized against their joint bounds. A chunk with fewer levels
+// than the others repeats its last one.
+MeshChunk mergeMeshChunks(std::vector<MeshChunk> &chunks)
+{
+  if (chunks.size() == 1)
+    return std::move(chunks.front());
+
+  MeshChunk merged;
+  size_t levelCount = 0;
+  std::vector<uint32_t> vertexOffsets;
+  for (const auto &chunk : chunks)
+  {
+    levelCount = std::max(levelCount, chunk.lodIndexCounts.size());
+    vertexOffsets.push_back(static_cast<uint32_t>(merged.vertices.size()));
+    merged.vertices.insert(merged.vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+    merged.optimization.add(chunk.optimization);
+  }
+
+  merged.lodIndexCounts.assign(levelCount, 0);
+  for (size_t level = 0; level < levelCount; level++)
+  {
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+      const auto &counts = chunks[i].lodIndexCounts;
+      size_t lod = std::min(level, counts.size() - 1);
+      size_t first = 0;
+      for (size_t previous = 0; previous < lod; previous++)
+      {
+        first += counts[previous];
+      }
+      for (size_t index = first; index < first + counts[lod]; index++)
+      {
+        merged.indices.push_back(chunks[i].indices[index] + vertexOffsets[i]);
+      }
+      merged.lodIndexCounts[level] += counts[lod];
+    }
+  }
+
+  return merged;
+}
+
+// Parses an OBJ file on a background thread and hands it out as chunks of
+// at most STREAM_CHUNK_TRIANGLES triangles, deduplicated within the chunk and
+// indexed relative to the chunk's first vertex. The producer blocks while the
+// queued chunks exceed the memory budget. Only the raw OBJ positions and
+// texture coordinates are kept for the whole file, since faces may refer
+// back to any of them.
+class MeshStreamer
+{
+public:
+  MeshStreamer(const std::string &path, size_t memoryBudget, const MeshProcessing &processing)
+      : memoryBudget(memoryBudget), processing(processing)
+  {
+    file.open(path);
+    if (!file.is_open())
+    {
+      throw std::runtime_error("failed to open model " + path + "!");
+    }
+
+    loader = std::thread([this]
+                         { load(); });
+  }
+
+  ~MeshStreamer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      cancelled = true;
+    }
+    spaceAvailable.notify_all();
+    loader.join();
+  }
+
+  MeshStreamer(const MeshStreamer &) = delete;
+  MeshStreamer &operator=(const MeshStreamer &) = delete;
+
+  // Takes the next chunk if one is ready. With `wait`, blocks until a chunk
+  // arrives or the file is exhausted. Rethrows parse errors.
+  bool pop(MeshChunk &chunk, bool wait)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (wait)
+    {
+      chunkAvailable.wait(lock, [this]
+                          { return !queue.empty() || done; });
+    }
+
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+
+    if (queue.empty())
+    {
+      return false;
+    }
+
+    chunk = std::move(queue.front());
+    queue.pop_front();
+    queuedBytes -= chunk.bytes();
+    lock.unlock();
+
+    spaceAvailable.notify_one();
+    return true;
+  }
+
+  bool finished()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return done && queue.empty();
+  }
+
+private:
+  struct Cancelled
+  {
+  };
+
+  std::ifstream file;
+  std::thread loader;
+  size_t memoryBudget;
+  MeshProcessing processing;
+
+  std::mutex mutex;
+  std::condition_variable chunkAvailable;
+  std::condition_variable spaceAvailable;
+  std::deque<MeshChunk> queue;
+  size_t queuedBytes = 0;
+  bool done = false;
+  std::atomic<bool> cancelled{false};
+  std::exception_ptr error;
+
+  std::vector<float> positions;
+  std::vector<float> texcoords;
+  std::vector<float> normals;
+  MeshChunk current;
+  std::unique_ptr<VertexDeduplicator> uniqueVertices;
+
+  void load()
+  {
+    tinyobj::callback_t callback;
+    callback.vertex_cb = [](void *userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t)
+    {
+      auto &positions = static_cast<MeshStreamer *>(userData)->positions;
+      positions.insert(positions.end(), {x, y, z});
+    };
+    callback.texcoord_cb = [](void *userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t)
+    {
+      auto &texcoords = static_cast<MeshStreamer *>(userData)->texcoords;
+      texcoords.insert(texcoords.end(), {x, y});
+    };
+    callback.normal_cb = [](void *userData, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z)
+    {
+      auto &normals = static_cast<MeshStreamer *>(userData)->normals;
+      normals.insert(normals.end(), {x, y, z});
+    };
+    callback.index_cb = [](void *userData, tinyobj::index_t *indices, int numIndices)
+    {
+      static_cast<MeshStreamer *>(userData)->addFace(indices, numIndices);
+    };
+
+    try
+    {
+      std::string warn, err;
+      if (!tinyobj::LoadObjWithCallback(file, callback, this, nullptr, &warn, &err))
+      {
+        throw std::runtime_error(warn + err);
+      }
+
+      if (!current.indices.empty())
+      {
+        push();
+      }
+    }
+    catch (const Cancelled &)
+    {
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    chunkAvailable.notify_all();
+  }
+
+  // Callback indices are raw OBJ indices: 1-based, negative ones relative to
+  // the end, and 0 when the attribute is absent.
+  static int resolve(int index, size_t count)
+  {
+    return index > 0 ? index - 1 : (index < 0 ? static_cast<int>(count) + index : -1);
+  }
+
+  void addFace(const tinyobj::index_t *indices, int numIndices)
+  {
+    if (cancelled)
+    {
+      throw Cancelled{};
+    }
+
+    for (int i = 1; i + 1 < numIndices; i++)
+    {
+      addCorner(indices[0]);
+      addCorner(indices[i]);
+      addCorner(indices[i + 1]);
+
+      if (current.indices.size() >= 3 * STREAM_CHUNK_TRIANGLES)
+      {
+        push();
+      }
+    }
+  }
+
+  void addCorner(const tinyobj::index_t &index)
+  {
+    if (!uniqueVertices)
+    {
+      uniqueVertices = std::make_unique<VertexDeduplicator>(3 * STREAM_CHUNK_TRIANGLES);
+    }
+
+    int position = resolve(index.vertex_index, positions.size() / 3);
+    int texcoord = resolve(index.texcoord_index, texcoords.size() / 2);
+    int normal = resolve(index.normal_index, normals.size() / 3);
+    if (position < 0 || 3 * static_cast<size_t>(position) >= positions.size())
+    {
+      throw std::runtime_error("invalid vertex index in model!");
+    }
+
+    Vertex vertex{};
+    vertex.pos = {positions[3 * position + 0], positions[3 * position + 1], positions[3 * position + 2]};
+    if (texcoord >= 0 && 2 * static_cast<size_t>(texcoord) < texcoords.size())
+    {
+      vertex.texCoord = {texcoords[2 * texcoord + 0], 1.0f - texcoords[2 * texcoord + 1]};
+    }
+    if (normal >= 0 && 3 * static_cast<size_t>(normal) < normals.size())
+    {
+      vertex.normal = {normals[3 * normal + 0], normals[3 * normal + 1], normals[3 * normal + 2]};
+    }
+
+    current.indices.push_back(uniqueVertices->insert(vertex, hashVertex(vertex), current.vertices));
+  }
+
+  void push()
+  {
+    current.lodIndexCounts = processMesh(current.vertices, current.indices, processing, current.optimization);
+
+    size_t bytes = current.bytes();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // A single chunk larger than the budget is still let through.
+      spaceAvailable.wait(lock, [&]
+                          { return cancelled || queue.empty() || queuedBytes + bytes <= memoryBudget; });
+      if (cancelled)
+      {
+        throw Cancelled{};
+      }
+
+      queuedBytes += bytes;
+      queue.push_back(std::move(current));
+    }
+    chunkAvailable.notify_one();
+
+    current = MeshChunk{};
+    uniqueVertices.reset();
+  }
+};
+
+// Start of the virtual texture feedback buffer as virtual.frag declares
+// it. One flag per page follows, level by level, which the fragment shader
+// sets for the pages it wants.
+struct VirtualTextureFeedbackHeader
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t levelCount;
+  uint32_t padding;
+  uint32_t levelOffsets[VT_MAX_LEVELS];
+};
+
+// CPU side of a virtual texture: which page sits in which slot of the
+// physical cache, the page table, and a loader thread cutting the pages
+// the feedback asks for out of the source mip chain. The chain stands in
+// for a tiled file on disk; only the device memory is bounded by the
+// cache. Level l has max(pagesWide >> l, 1) by max(pagesHigh >> l, 1)
+// pages, the level 0 page counts rounded up to powers of two, so the page
+// table is a mipmapped image and the coarsest level is a single page. That
+// page is loaded up front and never evicted, so every lookup resolves.
+class VirtualTexture
+{
+public:
+  // A page cut out on the loader thread: VT_SLOT_TEXELS square RGBA8
+  // texels including the border, and the cache slot it was given.
+  struct Tile
+  {
+    uint32_t page;
+    uint32_t slot;
+    std::vector<uint8_t> texels;
+  };
+
+  explicit VirtualTexture(DecodedImage image)
+      : textureWidth(static_cast<uint32_t>(image.width)), textureHeight(static_cast<uint32_t>(image.height))
+  {
+    pagesWide = roundUpToPowerOfTwo((textureWidth + VT_PAGE_TEXELS - 1) / VT_PAGE_TEXELS);
+    pagesHigh = roundUpToPowerOfTwo((textureHeight + VT_PAGE_TEXELS - 1) / VT_PAGE_TEXELS);
+    levels = 1;
+    while ((std::max(pagesWide, pagesHigh) >> (levels - 1)) > 1)
+    {
+      levels++;
+    }
+    if (levels > VT_MAX_LEVELS)
+    {
+      throw std::runtime_error("virtual texture is too large!");
+    }
+
+    source.resize(levels);
+    source[0].assign(image.pixels.get(), image.pixels.get() + static_cast<size_t>(textureWidth) * textureHeight * 4);
+    image.pixels.reset();
+    for (uint32_t level = 1; level < levels; level++)
+    {
+      source[level].resize(static_cast<size_t>(levelWidth(level)) * levelHeight(level) * 4);
+      downsampleRgba8(source[level - 1].data(), levelWidth(level - 1), levelHeight(level - 1), source[level].data());
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t level = 0; level < levels; level++)
+    {
+      levelOffsets.push_back(offset);
+      for (uint32_t page = 0; page < levelPagesWide(level) * levelPagesHigh(level); page++)
+      {
+        pages.push_back({level, NO_SLOT, 0, false});
+      }
+      offset += levelPagesWide(level) * levelPagesHigh(level);
+    }
+    pageTable.resize(pages.size());
+    slots.resize(VT_CACHE_PAGES_PER_SIDE * VT_CACHE_PAGES_PER_SIDE, NO_PAGE);
+
+    rootPage = levelOffsets.back();
+    pages[rootPage].loading = true;
+    loaded.push_back(cutTile(rootPage));
+
+    loader = std::thread([this]
+                         { load(); });
+  }
+
+  ~VirtualTexture()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    pageQueued.notify_all();
+    loader.join();
+  }
+
+  VirtualTexture(const VirtualTexture &) = delete;
+  VirtualTexture &operator=(const VirtualTexture &) = delete;
+
+  uint32_t levelCount() const
+  {
+    return levels;
+  }
+
+  uint32_t pageCount() const
+  {
+    return static_cast<uint32_t>(pages.size());
+  }
+
+  // Extent of the page table's level 0.
+  uint32_t pageTableWidth() const
+  {
+    return pagesWide;
+  }
+
+  uint32_t pageTableHeight() const
+  {
+    return pagesHigh;
+  }
+
+  // Index of the level's first page in the feedback flags and page table.
+  uint32_t levelOffset(uint32_t level) const
+  {
+    return levelOffsets[level];
+  }
+
+  uint32_t residentPages() const
+  {
+    return static_cast<uint32_t>(std::count_if(slots.begin(), slots.end(), [](uint32_t page)
+                                               { return page != NO_PAGE; }));
+  }
+
+  void writeFeedbackHeader(VirtualTextureFeedbackHeader &header) const
+  {
+    header = {};
+    header.width = textureWidth;
+    header.height = textureHeight;
+    header.levelCount = levels;
+    for (uint32_t level = 0; level < levels; level++)
+    {
+      header.levelOffsets[level] = levelOffsets[level];
+    }
+  }
+
+  // Takes a frame's feedback flags. Requested pages that are resident, or
+  // else their closest resident ancestor, are marked used at `frame`; the
+  // missing ones replace whatever the loader has not started on yet,
+  // coarsest first so that the fallback improves quickly.
+  void request(const uint32_t *requested, uint64_t frame)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (uint32_t page : queue)
+      {
+        pages[page].loading = false;
+      }
+      queue.clear();
+    }
+
+    std::vector<uint32_t> missing;
+    for (uint32_t page = 0; page < pages.size(); page++)
+    {
+      if (!requested[page])
+        continue;
+
+      if (pages[page].slot == NO_SLOT && !pages[page].loading)
+      {
+        missing.push_back(page);
+        pages[page].loading = true;
+      }
+
+      uint32_t resident = page;
+      while (pages[resident].slot == NO_SLOT && resident != rootPage)
+      {
+        resident = parent(resident);
+      }
+      pages[resident].lastUsed = frame;
+    }
+    if (missing.empty())
+      return;
+
+    std::stable_sort(missing.begin(), missing.end(), [this](uint32_t a, uint32_t b)
+                     { return pages[a].level > pages[b].level; });
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.assign(missing.begin(), missing.end());
+    }
+    pageQueued.notify_one();
+  }
+
+  // Places up to `maxTiles` loaded pages in the cache, evicting the least
+  // recently used pages not used at `frame`. Pages that find no slot are
+  // dropped and requested again by later feedback.
+  std::vector<Tile> takeLoaded(size_t maxTiles, uint64_t frame)
+  {
+    std::vector<Tile> tiles;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while (!loaded.empty() && tiles.size() < maxTiles)
+      {
+        tiles.push_back(std::move(loaded.front()));
+        loaded.pop_front();
+      }
+    }
+
+    auto placed = tiles.begin();
+    for (auto &tile : tiles)
+    {
+      Page &page = pages[tile.page];
+      page.loading = false;
+
+      uint32_t slot = findSlot(frame);
+      if (slot == NO_SLOT)
+        continue;
+
+      if (slots[slot] != NO_PAGE)
+      {
+        pages[slots[slot]].slot = NO_SLOT;
+      }
+      slots[slot] = tile.page;
+      page.slot = slot;
+      page.lastUsed = frame;
+      tile.slot = slot;
+      *placed++ = std::move(tile);
+      pageTableChanged = true;
+    }
+    tiles.erase(placed, tiles.end());
+    return tiles;
+  }
+
+  // The page table if it changed since the last call: an entry per page,
+  // level by level, holding the cache slot's x and y in the low two bytes
+  // and the level of the page actually in it (the page itself or its
+  // closest resident ancestor) in the third.
+  bool takePageTable(std::vector<uint32_t> &entries)
+  {
+    if (!pageTableChanged)
+      return false;
+    pageTableChanged = false;
+
+    for (uint32_t level = levels; level-- > 0;)
+    {
+      for (uint32_t page = levelOffsets[level]; page < levelOffsets[level] + levelPagesWide(level) * levelPagesHigh(level); page++)
+      {
+        uint32_t slot = pages[page].slot;
+        pageTable[page] = slot == NO_SLOT
+                              ? pageTable[parent(page)]
+                              : (slot % VT_CACHE_PAGES_PER_SIDE) | (slot / VT_CACHE_PAGES_PER_SIDE) << 8 | level << 16;
+      }
+    }
+
+    entries = pageTable;
+    return true;
+  }
+
+private:
+  static constexpr uint32_t NO_SLOT = std::numeric_limits<uint32_t>::max();
+  static constexpr uint32_t NO_PAGE = std::numeric_limits<uint32_t>::max();
+
+  struct Page
+  {
+    uint32_t level;
+    uint32_t slot;
+    uint64_t lastUsed;
+    // Queued on or being cut by the loader; only touched by the owner.
+    bool loading;
+  };
+
+  uint32_t textureWidth;
+  uint32_t textureHeight;
+  uint32_t pagesWide;
+  uint32_t pagesHigh;
+  uint32_t levels;
+  std::vector<std::vector<uint8_t>> source;
+  std::vector<uint32_t> levelOffsets;
+
+  std::vector<Page> pages;
+  std::vector<uint32_t> slots;
+  std::vector<uint32_t> pageTable;
+  bool pageTableChanged = false;
+  uint32_t rootPage;
+
+  std::thread loader;
+  std::mutex mutex;
+  std::condition_variable pageQueued;
+  std::deque<uint32_t> queue;
+  std::deque<Tile> loaded;
+  bool stopping = false;
+
+  static uint32_t roundUpToPowerOfTwo(uint32_t value)
+  {
+    uint32_t power = 1;
+    while (power < value)
+    {
+      power <<= 1;
+    }
+    return power;
+  }
+
+  uint32_t levelWidth(uint32_t level) const
+  {
+    return std::max(textureWidth >> level, 1u);
+  }
+
+  uint32_t levelHeight(uint32_t level) const
+  {
+    return std::max(textureHeight >> level, 1u);
+  }
+
+  uint32_t levelPagesWide(uint32_t level) const
+  {
+    return std::max(pagesWide >> level, 1u);
+  }
+
+  uint32_t levelPagesHigh(uint32_t level) const
+  {
+    return std::max(pagesHigh >> level, 1u);
+  }
+
+  // The page one level coarser covering `page`.
+  uint32_t parent(uint32_t page) const
+  {
+    uint32_t level = pages[page].level;
+    uint32_t index = page - levelOffsets[level];
+    uint32_t x = index % levelPagesWide(level);
+    uint32_t y = index / levelPagesWide(level);
+    return levelOffsets[level + 1] + (y >> 1) * levelPagesWide(level + 1) + (x >> 1);
+  }
+
+  // A free slot, or else the one whose page was used longest ago if that
+  // was before `frame`.
+  uint32_t findSlot(uint64_t frame) const
+  {
+    uint32_t victim = NO_SLOT;
+    for (uint32_t slot = 0; slot < slots.size(); slot++)
+    {
+      if (slots[slot] == NO_PAGE)
+        return slot;
+      if (slots[slot] == rootPage || pages[slots[slot]].lastUsed >= frame)
+        continue;
+      if (victim == NO_SLOT || pages[slots[slot]].lastUsed < pages[slots[victim]].lastUsed)
+      {
+        victim = slot;
+      }
+    }
+    return victim;
+  }
+
+  // Texels past the level's edge repeat the edge, like clamp-to-edge.
+  Tile cutTile(uint32_t page) const
+  {
+    uint32_t level = pages[page].level;
+    uint32_t index = page - levelOffsets[level];
+    int32_t left = static_cast<int32_t>(index % levelPagesWide(level) * VT_PAGE_TEXELS) - static_cast<int32_t>(VT_PAGE_BORDER);
+    int32_t top = static_cast<int32_t>(index / levelPagesWide(level) * VT_PAGE_TEXELS) - static_cast<int32_t>(VT_PAGE_BORDER);
+    int32_t maxX = static_cast<int32_t>(levelWidth(level)) - 1;
+    int32_t maxY = static_cast<int32_t>(levelHeight(level)) - 1;
+
+    Tile tile{page, NO_SLOT, std::vector<uint8_t>(static_cast<size_t>(VT_SLOT_TEXELS) * VT_SLOT_TEXELS * 4)};
+    uint8_t *out = tile.texels.data();
+    for (int32_t y = 0; y < static_cast<int32_t>(VT_SLOT_TEXELS); y++)
+    {
+      const uint8_t *row = source[level].data() + static_cast<size_t>(std::clamp(top + y, 0, maxY)) * levelWidth(level) * 4;
+      for (int32_t x = 0; x < static_cast<int32_t>(VT_SLOT_TEXELS); x++)
+      {
+        memcpy(out, row + static_cast<size_t>(std::clamp(left + x, 0, maxX)) * 4, 4);
+        out += 4;
+      }
+    }
+    return tile;
+  }
+
+  void load()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      pageQueued.wait(lock, [this]
+                      { return stopping || !queue.empty(); });
+      if (stopping)
+        return;
+
+      uint32_t page = queue.front();
+      queue.pop_front();
+      lock.unlock();
+      Tile tile = cutTile(page);
+      lock.lock();
+      loaded.push_back(std::move(tile));
+    }
+  }
+};
+
+// Watches GLSL sources on a worker thread. When one changes it is compiled
+// to its SPIR-V file with glslc and `build` creates a new pipeline from the
+// SPIR-V files, all off the render thread, which picks the pipeline up with
+// takePipeline() at a frame boundary. On a compile or build error the error
+// is reported and the running pipeline stays in use.
+class ShaderReloader
+{
+public:
+  struct Shader
+  {
+    std::string source;
+    std::string spirv;
+  };
+
+  ShaderReloader(VkDevice device, std::vector<Shader> shaders, std::function<VkPipeline()> build)
+      : device(device), build(std::move(build))
+  {
+    for (auto &shader : shaders)
+    {
+      auto time = lastWriteTime(shader.source);
+      watched.push_back({std::move(shader), time});
+    }
+
+    watcher = std::thread([this]
+                          { watch(); });
+  }
+
+  // A pipeline built but never taken is destroyed here.
+  ~ShaderReloader()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    condition.notify_all();
+    watcher.join();
+
+    if (pending != VK_NULL_HANDLE)
+    {
+      vkDestroyPipeline(device, pending, nullptr);
+    }
+  }
+
+  ShaderReloader(const ShaderReloader &) = delete;
+  ShaderReloader &operator=(const ShaderReloader &) = delete;
+
+  // Hands over the most recently built pipeline, or VK_NULL_HANDLE.
+  VkPipeline takePipeline()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::exchange(pending, VK_NULL_HANDLE);
+  }
+
+private:
+  struct WatchedShader
+  {
+    Shader shader;
+    std::filesystem::file_time_type lastWrite;
+  };
+
+  VkDevice device;
+  std::function<VkPipeline()> build;
+  std::vector<WatchedShader> watched;
+  std::thread watcher;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+  VkPipeline pending = VK_NULL_HANDLE;
+
+  static std::filesystem::file_time_type lastWriteTime(const std::string &path)
+  {
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+  }
+
+  void watch()
+  {
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (condition.wait_for(lock, SHADER_RELOAD_POLL_INTERVAL, [this]
+                               { return stopping; }))
+          return;
+      }
+
+      bool changed = false;
+      bool compiled = true;
+      for (auto &entry : watched)
+      {
+        auto time = lastWriteTime(entry.shader.source);
+        if (time == entry.lastWrite)
+          continue;
+
+        // Editors often write a file in several steps, so a source that
+        // fails to compile is retried on its next change.
+        entry.lastWrite = time;
+        changed = true;
+        std::string command = std::string(GLSLC_EXECUTABLE) + " \"" + entry.shader.source + "\" -o \"" + entry.shader.spirv + "\"";
+        if (std::system(command.c_str()) != 0)
+        {
+          std::cerr << "shader reload: failed to compile " << entry.shader.source << std::endl;
+          compiled = false;
+        }
+      }
+
+      if (!changed || !compiled)
+        continue;
+
+      VkPipeline pipeline;
+      try
+      {
+        pipeline = build();
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "shader reload: " << e.what() << std::endl;
+        continue;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending != VK_NULL_HANDLE)
+      {
+        vkDestroyPipeline(device, pending, nullptr);
+      }
+      pending = pipeline;
+    }
+  }
+};
+
+// A pipeline replaced by a reload or an optimized link, destroyed once the
+// frame timeline reaches the last submission that may have used it.
+struct RetiredPipeline
+{
+  VkPipeline pipeline;
+  uint64_t lastSubmission;
+};
+
+// A streamed mesh buffer replaced by a larger one. The submission that
+// copies it over is the last to read it.
+struct RetiredBuffer
+{
+  VkBuffer buffer;
+  Allocation allocation;
+  uint64_t lastSubmission;
+};
+
+// A pipeline from the linker thread, for the render mode's pipelines built
+// from one version of the shaders: a link-time optimized link, or without
+// libraries a pipeline built in one piece ahead of the mode's first use.
+struct OptimizedPipeline
+{
+  uint32_t mode;
+  uint64_t generation;
+  VkPipeline pipeline;
+};
+
+// A range of the index buffer drawn with its own vertex offset. Ranges of
+// a level above 0 are only drawn by the instances the cull pass assigns to
+// that level.
+struct MeshDrawRange
+{
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  int32_t vertexOffset;
+  VertexDequantization dequantization;
+  uint32_t lod;
+};
+
+// Adds a range for every one of `lodLevels` levels. processMesh() stops
+// early when simplification stalls, so the levels it could not build reuse
+// its last one; the cull pass still assigns instances to them.
+void appendLodDrawRanges(std::vector<MeshDrawRange> &ranges, uint32_t firstIndex, int32_t vertexOffset, const VertexDequantization &dequantization, const std::vector<uint32_t> &lodIndexCounts, uint32_t lodLevels)
+{
+  for (uint32_t lod = 0; lod < std::max(lodLevels, static_cast<uint32_t>(lodIndexCounts.size())); lod++)
+  {
+    if (lod < lodIndexCounts.size())
+    {
+      ranges.push_back({firstIndex, lodIndexCounts[lod], vertexOffset, dequantization, lod});
+      firstIndex += lodIndexCounts[lod];
+    }
+    else
+    {
+      MeshDrawRange last = ranges.back();
+      last.lod = lod;
+      ranges.push_back(last);
+    }
+  }
+}
+
+// The culling shader needs the separate matrices; vertices only use the
+// product, computed once per frame instead of once per vertex.
+struct UniformBufferObject
+{
+  alignas(16) glm::mat4 model;
+  alignas(16) glm::mat4 view;
+  alignas(16) glm::mat4 proj;
+  alignas(16) glm::mat4 modelViewProj;
+};
+
+// Push constants of shaders/cull.comp. The bounding sphere is in mesh space.
+struct CullParameters
+{
+  glm::vec4 boundingSphere;
+  uint32_t instanceCount;
+  uint32_t lodCount;
+  float lodScreenSize;
+};
+
+// The indirect buffer starts with the visible instance count of every LOD,
+// followed by the draw commands.
+const VkDeviceSize INDIRECT_COMMANDS_OFFSET = MAX_LOD_LEVELS * sizeof(uint32_t);
+
+// Shader stages and fixed-function state of the graphics pipeline in one
+// render mode. The create infos it returns point into it.
+struct GraphicsPipelineState
+{
+  uint32_t shading;
+  VkSpecializationMapEntry shadingEntry{};
+  VkSpecializationInfo specialization{};
+  std::array<VkPipelineShaderStageCreateInfo, 2> stages{};
+
+  std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = PackedVertex::getBindingDescriptions();
+  std::array<VkVertexInputAttributeDescription, 7> attributeDescriptions = PackedVertex::getAttributeDescriptions();
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  VkPipelineViewportStateCreateInfo viewportState{};
+  VkPipelineRasterizationStateCreateInfo rasterizer{};
+  VkPipelineMultisampleStateCreateInfo multisampling{};
+  VkPipelineDepthStencilStateCreateInfo depthStencil{};
+  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+  VkPipelineColorBlendStateCreateInfo colorBlending{};
+  std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+
+  GraphicsPipelineState(const RenderMode &mode, VkShaderModule vertShaderModule, VkShaderModule fragShaderModule)
+      : shading(mode.shading)
+  {
+    shadingEntry.constantID = 0;
+    shadingEntry.offset = 0;
+    shadingEntry.size = sizeof(shading);
+
+    specialization.mapEntryCount = 1;
+    specialization.pMapEntries = &shadingEntry;
+    specialization.dataSize = sizeof(shading);
+    specialization.pData = &shading;
+
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertShaderModule;
+    stages[0].pName = "main";
+
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragShaderModule;
+    stages[1].pName = "main";
+    stages[1].pSpecializationInfo = &specialization;
+
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = mode.polygonMode;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = mode.cullMode;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // Blended geometry is seen through, so it does not occlude itself.
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = mode.blend ? VK_FALSE : VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = mode.blend ? VK_TRUE : VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_CONSTANT_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_CONSTANT_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+    colorBlending.blendConstants[0] = 0.0f;
+    colorBlending.blendConstants[1] = 0.0f;
+    colorBlending.blendConstants[2] = 0.0f;
+    colorBlending.blendConstants[3] = 0.35f;
+
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
+  }
+
+  GraphicsPipelineState(const GraphicsPipelineState &) = delete;
+  GraphicsPipelineState &operator=(const GraphicsPipelineState &) = delete;
+
+  VkGraphicsPipelineCreateInfo complete(VkPipelineLayout layout, VkRenderPass renderPass)
+  {
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+    pipelineInfo.pStages = stages.data();
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = layout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    return pipelineInfo;
+  }
+
+  // Only the state of one library part. The library keeps what a
+  // link-time optimized link needs.
+  VkGraphicsPipelineCreateInfo library(VkGraphicsPipelineLibraryFlagsEXT part, VkPipelineLayout layout, VkRenderPass renderPass)
+  {
+    libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    libraryInfo.flags = part;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = &libraryInfo;
+    pipelineInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+    switch (part)
+    {
+    case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+      pipelineInfo.pVertexInputState = &vertexInputInfo;
+      pipelineInfo.pInputAssemblyState = &inputAssembly;
+      break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+      pipelineInfo.stageCount = 1;
+      pipelineInfo.pStages = &stages[0];
+      pipelineInfo.pViewportState = &viewportState;
+      pipelineInfo.pRasterizationState = &rasterizer;
+      pipelineInfo.pDynamicState = &dynamicState;
+      pipelineInfo.layout = layout;
+      pipelineInfo.renderPass = renderPass;
+      break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+      pipelineInfo.stageCount = 1;
+      pipelineInfo.pStages = &stages[1];
+      pipelineInfo.pMultisampleState = &multisampling;
+      pipelineInfo.pDepthStencilState = &depthStencil;
+      pipelineInfo.layout = layout;
+      pipelineInfo.renderPass = renderPass;
+      break;
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT:
+      pipelineInfo.pMultisampleState = &multisampling;
+      pipelineInfo.pColorBlendState = &colorBlending;
+      pipelineInfo.renderPass = renderPass;
+      break;
+    }
+    pipelineInfo.subpass = 0;
+    return pipelineInfo;
+  }
+};
+
+// The graphics pipeline parts built once per version of the shaders, each
+// shared by all render modes with the same state for it. Links only need
+// the parts while they run, so background links hold a reference.
+struct GraphicsPipelineLibraries
+{
+  VkDevice device;
+  VkPipeline vertexInput = VK_NULL_HANDLE;
+  std::map<std::pair<VkCullModeFlags, VkPolygonMode>, VkPipeline> preRasterization;
+  std::map<std::pair<uint32_t, bool>, VkPipeline> fragmentShader;
+  std::map<bool, VkPipeline> fragmentOutput;
+
+  explicit GraphicsPipelineLibraries(VkDevice device) : device(device) {}
+
+  ~GraphicsPipelineLibraries()
+  {
+    std::vector<VkPipeline> pipelines = {vertexInput};
+    for (const auto &entry : preRasterization)
+    {
+      pipelines.push_back(entry.second);
+    }
+    for (const auto &entry : fragmentShader)
+    {
+      pipelines.push_back(entry.second);
+    }
+    for (const auto &entry : fragmentOutput)
+    {
+      pipelines.push_back(entry.second);
+    }
+
+    for (VkPipeline pipeline : pipelines)
+    {
+      if (pipeline != VK_NULL_HANDLE)
+      {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
+  }
+
+  GraphicsPipelineLibraries(const GraphicsPipelineLibraries &) = delete;
+  GraphicsPipelineLibraries &operator=(const GraphicsPipelineLibraries &) = delete;
+
+  std::array<VkPipeline, 4> parts(const RenderMode &mode) const
+  {
+    return {
+        vertexInput,
+        preRasterization.at({mode.cullMode, mode.polygonMode}),
+        fragmentShader.at({mode.shading, mode.blend}),
+        fragmentOutput.at(mode.blend)};
+  }
+};
+
+class HelloTriangleApplication
+{
+public:
+  explicit HelloTriangleApplication(const Options &options) : options(options), framesInFlight(options.framesInFlight)
+  {
+    if (options.targetFps > 0.0)
+    {
+      framePacer = std::make_unique<FramePacer>(options.targetFps);
+    }
+  }
+
+  void run()
+  {
+    startup();
+    mainLoop();
+    cleanup();
+  }
+
+private:
+  Options options;
+  uint32_t framesInFlight;
+
+  GLFWwindow *window = nullptr;
+
+  VkInstance instance;
+  VkDebugUtilsMessengerEXT debugMessenger;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device;
+  DeviceAllocator allocator;
+  UploadEngine uploads;
+  bool samplerAnisotropySupported = false;
+
+  VkQueue graphicsQueue;
+  VkQueue presentQueue;
+
+  VkSwapchainKHR swapChain;
+  std::vector<VkImage> swapChainImages;
+  VkFormat swapChainImageFormat;
+  VkExtent2D swapChainExtent;
+  VkPresentModeKHR swapChainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+  std::vector<VkImageView> swapChainImageViews;
+  std::vector<VkFramebuffer> swapChainFramebuffers;
+
+  // In headless mode the swap chain members describe offscreen color targets,
+  // one per frame in flight, backed by these allocations.
+  std::vector<Allocation> offscreenImageAllocations;
+
+  VkRenderPass renderPass;
+  VkDescriptorSetLayout descriptorSetLayout;
+  VkPipelineLayout pipelineLayout;
+  VkPipeline graphicsPipeline;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  bool pipelineCreationFeedbackSupported = false;
+  PipelineCacheStatistics pipelineCacheStatistics;
+
+  VkCommandPool commandPool;
+
+  VkImage depthImage;
+  Allocation depthImageAllocation;
+  VkImageView depthImageView;
+  // Size of the depth image, which may exceed the swap chain after a shrink.
+  VkExtent2D depthExtent{};
+
+  std::vector<RetiredSwapChain> retiredSwapChains;
+
+  // Filled by decodeTexture() and consumed by the upload.
+  std::vector<Ktx2Texture> compressedTextures;
+  DecodedImage decodedTexture;
+
+  // With virtual texturing textureImage is the physical page cache. Each
+  // frame in flight has a feedback buffer the fragment shader flags the
+  // pages it wants in, and staging for the pages and page table uploaded
+  // with the frame.
+  bool virtualTexturing = false;
+  std::unique_ptr<VirtualTexture> virtualTexture;
+  VkImage pageTableImage = VK_NULL_HANDLE;
+  Allocation pageTableAllocation;
+  VkImageView pageTableImageView = VK_NULL_HANDLE;
+  VkSampler pageTableSampler = VK_NULL_HANDLE;
+  VkImageLayout pageCacheLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkImageLayout pageTableLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  std::vector<VkBuffer> feedbackBuffers;
+  std::vector<Allocation> feedbackAllocations;
+  std::vector<VkBuffer> pageStagingBuffers;
+  std::vector<Allocation> pageStagingAllocations;
+
+  // With bindless materials set 1 is an array of textures indexed by the
+  // material of each instance. Element 0 is textureImage, the rest are the
+  // diffuse textures of the model's materials. Update-after-bind sets cannot
+  // hold the dynamic uniform buffer of set 0, so the array has a set, layout
+  // and pool of its own, shared by all frames.
+  bool bindlessMaterials = false;
+  uint32_t materialTextureLimit = 1;
+  VkDescriptorSetLayout materialDescriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool materialDescriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet materialDescriptorSet = VK_NULL_HANDLE;
+  std::vector<std::string> materialTexturePaths;
+  std::vector<DecodedImage> decodedMaterials;
+  std::vector<MaterialTexture> materialTextures;
+
+  uint32_t mipLevels;
+  VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  VkImage textureImage;
+  Allocation textureImageAllocation;
+  VkImageView textureImageView;
+  VkSampler textureSampler;
+
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  Allocation vertexBufferAllocation;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  Allocation indexBufferAllocation;
+  std::vector<MeshDrawRange> meshDrawRanges;
+  VertexDequantization meshDequantization;
+  // Index count of every LOD of the non-streamed model.
+  std::vector<uint32_t> lodIndexCounts;
+  MeshOptimizationStatistics meshOptimizationStatistics;
+
+  VkBuffer instanceBuffer = VK_NULL_HANDLE;
+  Allocation instanceBufferAllocation;
+
+  // Mesh-space bounds of everything uploaded so far, for culling.
+  glm::vec3 meshBoundsMin = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 meshBoundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+  // With GPU culling each frame compacts its visible instances into its own
+  // buffer and draws them through its own host-written indirect commands.
+  VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+  VkPipeline cullPipeline = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> cullDescriptorSets;
+  std::vector<VkBuffer> visibleInstanceBuffers;
+  std::vector<Allocation> visibleInstanceBuffersAllocations;
+  std::vector<VkBuffer> indirectBuffers;
+  std::vector<Allocation> indirectBuffersAllocations;
+  std::vector<uint32_t> indirectBufferCapacities;
+
+  // Streaming keeps growing vertexBuffer and indexBuffer as chunks arrive;
+  // the capacities and counts are in elements.
+  std::unique_ptr<MeshStreamer> meshStreamer;
+
+  std::unique_ptr<ShaderReloader> shaderReloader;
+  std::vector<RetiredPipeline> retiredPipelines;
+
+  bool graphicsPipelineLibrarySupported = false;
+  bool fillModeNonSolidSupported = false;
+  std::atomic<uint32_t> renderMode{0};
+  // Pipeline of every render mode used since the shaders were last loaded;
+  // graphicsPipeline is the one of renderMode.
+  std::array<VkPipeline, RENDER_MODES.size()> renderModePipelines{};
+  std::shared_ptr<GraphicsPipelineLibraries> pipelineLibraries;
+  std::unique_ptr<ThreadPool> pipelineLinker;
+  uint64_t shaderGeneration = 0;
+  std::mutex pipelineStatisticsMutex;
+
+  // Handed over from the linker and shader reload threads.
+  std::mutex pipelineMutex;
+  std::vector<OptimizedPipeline> optimizedPipelines;
+  std::shared_ptr<GraphicsPipelineLibraries> reloadedLibraries;
+  uint32_t reloadedRenderMode = 0;
+
+  std::vector<RetiredBuffer> retiredMeshBuffers;
+  uint32_t vertexCapacity = 0;
+  uint32_t indexCapacity = 0;
+  uint32_t streamedVertexCount = 0;
+  uint32_t streamedIndexCount = 0;
+
+  VkBuffer frameDataBuffer;
+  Allocation frameDataAllocation;
+  // Only holds the frame's UniformBufferObject for now. Per-object data is
+  // the instance buffer, which the cull pass reads and compacts on the GPU,
+  // and per-draw data is the pushed dequantization.
+  FrameDataRing frameData;
+  // Dynamic offset of this frame's UniformBufferObject in frameDataBuffer.
+  uint32_t uniformOffset = 0;
+
+  VkDescriptorPool descriptorPool;
+  std::vector<VkDescriptorSet> descriptorSets;
+
+  std::vector<VkCommandBuffer> commandBuffers;
+  std::vector<VkCommandBuffer> uploadCommandBuffers;
+
+  // Parallel recording splits the draws into up to recordThreads slices,
+  // by draw range or, when there are fewer ranges than threads, by instance.
+  // Each slice has its own pool and secondary buffer per frame in flight, indexed
+  // [frame * recordThreads + slice]. A pool is only ever touched by the
+  // worker recording its slice and is reset as a whole.
+  std::unique_ptr<ThreadPool> recordPool;
+  std::vector<VkCommandPool> secondaryCommandPools;
+  std::vector<VkCommandBuffer> secondaryCommandBuffers;
+
+  // Cached command buffers are kept per (image, frame in flight), indexed
+  // [image * framesInFlight + frame], and only re-recorded when
+  // sceneVersion has moved past the version they were recorded at.
+  std::vector<VkCommandBuffer> cachedCommandBuffers;
+  std::vector<uint64_t> cachedCommandBufferVersions;
+  uint64_t sceneVersion = 1;
+  uint64_t commandBufferRecordings = 0;
+
+  // Every frame submission signals the next value of frameTimeline; the CPU
+  // waits for exactly the value a frame slot last submitted.
+  VkSemaphore frameTimeline;
+  uint64_t submissionCount = 0;
+  std::vector<uint64_t> frameSubmissions;
+  std::vector<VkSemaphore> imageAvailableSemaphores;
+  // Indexed by swap chain image: a present's semaphore is only signalled
+  // again once the presentation engine has handed that image back.
+  std::vector<VkSemaphore> presentSemaphores;
+  uint32_t currentFrame = 0;
+
+  // Latency is measured from the frame's start, before input is sampled,
+  // to the completion of its submission on the frame timeline.
+  std::unique_ptr<FramePacer> framePacer;
+  FramePacer::Clock::time_point frameStart;
+  std::vector<FramePacer::Clock::time_point> frameStartTimes;
+  std::vector<bool> latencyPending;
+
+  VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+  std::vector<bool> timestampsWritten;
+  uint32_t timestampValidBits = 0;
+  float timestampPeriod = 0.0f;
+
+  FrameStatistics cpuTimings;
+
+  StartupGraph startupGraph{PROCESS_START};
+  std::chrono::steady_clock::time_point firstFrameTime;
+  FrameStatistics gpuTimings;
+
+  bool framebufferResized = false;
+  std::chrono::steady_clock::time_point lastResizeEvent;
+
+  void initWindow()
+  {
+    glfwInit();
+
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+    window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    glfwSetWindowUserPointer(window, this);
+    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    glfwSetKeyCallback(window, keyCallback);
+  }
+
+  // M cycles through the render modes.
+  static void keyCallback(GLFWwindow *window, int key, int, int action, int)
+  {
+    if (key != GLFW_KEY_M || action != GLFW_PRESS)
+      return;
+
+    auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
+    for (uint32_t step = 1; step < RENDER_MODES.size(); step++)
+    {
+      uint32_t mode = (app->renderMode + step) % RENDER_MODES.size();
+      if (app->renderModeSupported(RENDER_MODES[mode]))
+      {
+        app->useRenderMode(mode);
+        std::cerr << "render mode: " << RENDER_MODES[mode].name << std::endl;
+        return;
+      }
+    }
+  }
+
+  static void framebufferResizeCallback(GLFWwindow *window, int width, int height)
+  {
+    auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
+    app->framebufferResized = true;
+    app->lastResizeEvent = std::chrono::steady_clock::now();
+  }
+
+  // Builds the window, the device and every resource of the first frame.
+  // Decoding the texture and loading the model start right away, in
+  // parallel with device creation, and are uploaded as soon as both are
+  // done; the pipelines are built while the main thread creates the rest.
+  void startup()
+  {
+    std::vector<uint32_t> windowStep;
+    if (!options.headless)
+    {
+      windowStep.push_back(startupGraph.add("window", {}, [this]
+                                            { initWindow(); }));
+    }
+
+    uint32_t decodeStep = startupGraph.addBackground("decode texture", {}, [this]
+                                                     { decodeTexture(); });
+    uint32_t meshStep;
+    if (options.stream)
+    {
+      meshStep = startupGraph.addBackground("start mesh stream", {}, [this]
+                                            { startMeshStream(); });
+    }
+    else
+    {
+      meshStep = startupGraph.addBackground("load model", {}, [this]
+                                            {
+                                              loadModel();
+                                              processModel(); });
+    }
+
+    // The material textures are named by the model's material library, and
+    // the mesh upload waits for them in case some exceed the device limits.
+    std::vector<uint32_t> materialSteps;
+    if (options.bindless)
+    {
+      materialSteps.push_back(startupGraph.addBackground("decode materials", {meshStep}, [this]
+                                                         { decodeMaterials(); }));
+    }
+
+    uint32_t instanceStep = startupGraph.add("instance", windowStep, [this]
+                                             {
+                                               createInstance();
+                                               setupDebugMessenger();
+                                               createSurface(); });
+    uint32_t deviceStep = startupGraph.add("device", {instanceStep}, [this]
+                                           {
+                                             pickPhysicalDevice();
+                                             createLogicalDevice(); });
+    uint32_t swapChainStep = startupGraph.add("swap chain", {deviceStep}, [this]
+                                              {
+                                                if (options.headless)
+                                                {
+                                                  createOffscreenTargets();
+                                                }
+                                                else
+                                                {
+                                                  createSwapChain();
+                                                }
+                                                createImageViews();
+                                                createRenderPass(); });
+    uint32_t layoutStep = startupGraph.add("descriptor set layout", {deviceStep}, [this]
+                                           {
+                                             createDescriptorSetLayout();
+                                             createPipelineCache(); });
+
+    std::vector<uint32_t> pipelineSteps;
+    pipelineSteps.push_back(startupGraph.addBackground("graphics pipeline", {swapChainStep, layoutStep}, [this]
+                                                       { createGraphicsPipeline(); }));
+    if (options.gpuCulling)
+    {
+      pipelineSteps.push_back(startupGraph.addBackground("cull pipeline", {layoutStep}, [this]
+                                                         { createCullPipeline(); }));
+    }
+
+    uint32_t textureStep = startupGraph.add("texture upload", {deviceStep, decodeStep}, [this]
+                                            {
+                                              if (virtualTexturing)
+                                              {
+                                                createVirtualTexture();
+                                              }
+                                              else
+                                              {
+                                                createTextureImage();
+                                                createTextureImageView();
+                                              }
+                                              createTextureSampler(); });
+    if (options.bindless)
+    {
+      materialSteps = {startupGraph.add("material upload", {deviceStep, materialSteps.back()}, [this]
+                                        { createMaterialTextures(); })};
+    }
+    if (!options.stream)
+    {
+      std::vector<uint32_t> meshUploadDependencies = materialSteps;
+      meshUploadDependencies.insert(meshUploadDependencies.end(), {deviceStep, meshStep});
+      meshStep = startupGraph.add("mesh upload", meshUploadDependencies, [this]
+                                  {
+                                    createVertexBuffer();
+                                    createIndexBuffer(); });
+    }
+    std::vector<uint32_t> bufferDependencies = materialSteps;
+    bufferDependencies.push_back(deviceStep);
+    uint32_t bufferStep = startupGraph.add("instance and frame buffers", bufferDependencies, [this]
+                                           {
+                                             createInstanceBuffer();
+                                             createUniformBuffers(); });
+    uint32_t framebufferStep = startupGraph.add("framebuffers", {swapChainStep}, [this]
+                                                {
+                                                  createCommandPool();
+                                                  createDepthResources();
+                                                  createFramebuffers(); });
+    uint32_t descriptorStep = startupGraph.add("descriptor sets", {layoutStep, textureStep, bufferStep}, [this]
+                                               {
+                                                 createDescriptorPool();
+                                                 createDescriptorSets(); });
+
+    std::vector<uint32_t> commandDependencies = pipelineSteps;
+    commandDependencies.insert(commandDependencies.end(), {meshStep, framebufferStep, descriptorStep});
+    if (options.gpuCulling)
+    {
+      commandDependencies.push_back(startupGraph.add("cull buffers", {pipelineSteps.back(), meshStep, bufferStep, descriptorStep}, [this]
+                                                     { createCullBuffers(); }));
+    }
+    startupGraph.add("command buffers", commandDependencies, [this]
+                     {
+                       createCommandBuffers();
+                       createSyncObjects();
+                       createTimestampQueryPool(); });
+
+    {
+      ThreadPool pool(STARTUP_THREADS);
+      startupGraph.run(pool);
+    }
+
+    if (options.hotReload)
+    {
+      shaderReloader = std::make_unique<ShaderReloader>(
+          device,
+          std::vector<ShaderReloader::Shader>{{SHADER_SOURCE_DIR "/shader.vert", "shaders/vert.spv"},
+                                              {fragmentShaderSource(), fragmentShaderPath()}},
+          [this]
+          { return rebuildGraphicsPipeline(); });
+    }
+  }
+
+  void mainLoop()
+  {
+    auto startTime = std::chrono::steady_clock::now();
+
+    // A headless frame is a single image, so it needs the whole mesh.
+    if (meshStreamer && options.headless)
+    {
+      uploadMeshChunks(true);
+    }
+
+    uint32_t frame = 0;
+    for (; options.frameCount == 0 || frame < options.frameCount; frame++)
+    {
+      paceFrame();
+
+      if (!options.headless)
+      {
+        if (glfwWindowShouldClose(window))
+        {
+          break;
+        }
+        glfwPollEvents();
+      }
+
+      if (meshStreamer)
+      {
+        uploadMeshChunks(false);
+      }
+
+      drawFrame();
+
+      if (frame == 0)
+      {
+        firstFrameTime = std::chrono::steady_clock::now();
+        if (options.startupTimeline)
+        {
+          // Benchmark runs keep stdout for the JSON report.
+          startupGraph.writeTimeline(options.benchmarkFrames == 0 ? std::cout : std::cerr, firstFrameTime);
+        }
+      }
+    }
+
+    vkDeviceWaitIdle(device);
+    // Nothing may touch the pipeline cache statistics while they are reported.
+    shaderReloader.reset();
+    pipelineLinker.reset();
+
+    if (options.benchmarkFrames > 0)
+    {
+      for (uint32_t i = 0; i < framesInFlight; i++)
+      {
+        collectTimestamps(i);
+      }
+
+      double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      printBenchmarkReport(frame, totalSeconds);
+    }
+
+    if (!options.outputPath.empty())
+    {
+      uint32_t lastImageIndex = (currentFrame + framesInFlight - 1) % framesInFlight;
+      saveOffscreenImage(lastImageIndex, options.outputPath);
+    }
+  }
+
+  void cleanupSwapChain()
+  {
+    for (auto &retired : retiredSwapChains)
+    {
+      destroyRetiredSwapChain(retired);
+    }
+    retiredSwapChains.clear();
+
+    vkDestroyImageView(device, depthImageView, nullptr);
+    vkDestroyImage(device, depthImage, nullptr);
+    allocator.free(depthImageAllocation);
+
+    for (auto framebuffer : swapChainFramebuffers)
+    {
+      vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+
+    for (auto imageView : swapChainImageViews)
+    {
+      vkDestroyImageView(device, imageView, nullptr);
+    }
+
+    for (auto semaphore : presentSemaphores)
+    {
+      vkDestroySemaphore(device, semaphore, nullptr);
+    }
+
+    if (options.headless)
+    {
+      for (size_t i = 0; i < swapChainImages.size(); i++)
+      {
+        vkDestroyImage(device, swapChainImages[i], nullptr);
+        allocator.free(offscreenImageAllocations[i]);
+      }
+    }
+    else
+    {
+      vkDestroySwapchainKHR(device, swapChain, nullptr);
+    }
+  }
+
+  void cleanup()
+  {
+    cleanupSwapChain();
+
+    shaderReloader.reset();
+    pipelineLinker.reset();
+    for (const auto &optimized : optimizedPipelines)
+    {
+      vkDestroyPipeline(device, optimized.pipeline, nullptr);
+    }
+    optimizedPipelines.clear();
+    for (const auto &retired : retiredPipelines)
+    {
+      vkDestroyPipeline(device, retired.pipeline, nullptr);
+    }
+    retiredPipelines.clear();
+
+    for (VkPipeline pipeline : renderModePipelines)
+    {
+      if (pipeline != VK_NULL_HANDLE)
+      {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+    }
+    pipelineLibraries.reset();
+    reloadedLibraries.reset();
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+
+    if (cullPipeline != VK_NULL_HANDLE)
+    {
+      vkDestroyPipeline(device, cullPipeline, nullptr);
+      vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+      vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, nullptr);
+    }
+
+    for (size_t i = 0; i < visibleInstanceBuffers.size(); i++)
+    {
+      vkDestroyBuffer(device, visibleInstanceBuffers[i], nullptr);
+      allocator.free(visibleInstanceBuffersAllocations[i]);
+      vkDestroyBuffer(device, indirectBuffers[i], nullptr);
+      allocator.free(indirectBuffersAllocations[i]);
+    }
+
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    vkDestroyRenderPass(device, renderPass, nullptr);
+
+    vkDestroyBuffer(device, frameDataBuffer, nullptr);
+    allocator.free(frameDataAllocation);
+
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorPool(device, materialDescriptorPool, nullptr);
+
+    vkDestroySampler(device, textureSampler, nullptr);
+    vkDestroyImageView(device, textureImageView, nullptr);
+
+    vkDestroyImage(device, textureImage, nullptr);
+    allocator.free(textureImageAllocation);
+
+    for (auto &material : materialTextures)
+    {
+      vkDestroyImageView(device, material.view, nullptr);
+      vkDestroyImage(device, material.image, nullptr);
+      allocator.free(material.allocation);
+    }
+
+    if (virtualTexturing)
+    {
+      virtualTexture.reset();
+      vkDestroySampler(device, pageTableSampler, nullptr);
+      vkDestroyImageView(device, pageTableImageView, nullptr);
+      vkDestroyImage(device, pageTableImage, nullptr);
+      allocator.free(pageTableAllocation);
+      for (uint32_t i = 0; i < framesInFlight; i++)
+      {
+        vkDestroyBuffer(device, feedbackBuffers[i], nullptr);
+        allocator.free(feedbackAllocations[i]);
+        vkDestroyBuffer(device, pageStagingBuffers[i], nullptr);
+        allocator.free(pageStagingAllocations[i]);
+      }
+    }
+
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, materialDescriptorSetLayout, nullptr);
+
+    meshStreamer.reset();
+
+    vkDestroyBuffer(device, instanceBuffer, nullptr);
+    allocator.free(instanceBufferAllocation);
 
     vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
+    allocator.free(indexBufferAllocation);
 
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
+    allocator.free(vertexBufferAllocation);
+
+    for (auto &retired : retiredMeshBuffers)
+    {
+      vkDestroyBuffer(device, retired.buffer, nullptr);
+      allocator.free(retired.allocation);
+    }
+    retiredMeshBuffers.clear();
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    for (size_t i = 0; i < framesInFlight; i++)
     {
-      vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
       vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-      vkDestroyFence(device, inFlightFences[i], nullptr);
+    }
+    vkDestroySemaphore(device, frameTimeline, nullptr);
+
+    if (timestampQueryPool != VK_NULL_HANDLE)
+    {
+      vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+    }
+
+    recordPool.reset();
+    for (auto pool : secondaryCommandPools)
+    {
+      vkDestroyCommandPool(device, pool, nullptr);
     }
 
     vkDestroyCommandPool(device, commandPool, nullptr);
 
+    uploads.destroy();
+    allocator.destroy();
+
     vkDestroyDevice(device, nullptr);
 
     if (enableValidationLayers)
@@ -343,14 +4493,24 @@ private:
       DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
     }
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (surface != VK_NULL_HANDLE)
+    {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
+    if (window != nullptr)
+    {
+      glfwDestroyWindow(window);
 
-    glfwTerminate();
+      glfwTerminate();
+    }
   }
 
+  // Replaces the swap chain without waiting for the device: the old one is
+  // handed to the new one as oldSwapchain, and it and everything built on it
+  // are destroyed once the frames still using them have completed. The depth
+  // image is kept as long as it covers the new extent.
   void recreateSwapChain()
   {
     int width = 0, height = 0;
@@ -361,14 +4521,90 @@ private:
       glfwWaitEvents();
     }
 
-    vkDeviceWaitIdle(device);
+    auto start = std::chrono::steady_clock::now();
+
+    RetiredSwapChain retired;
+    retired.swapChain = swapChain;
+    retired.imageViews = std::move(swapChainImageViews);
+    retired.framebuffers = std::move(swapChainFramebuffers);
+    retired.presentSemaphores = std::move(presentSemaphores);
+    retired.commandBuffers = std::move(cachedCommandBuffers);
+    retired.lastSubmission = submissionCount;
+    swapChainImageViews.clear();
+    swapChainFramebuffers.clear();
+    presentSemaphores.clear();
+    cachedCommandBuffers.clear();
+
+    createSwapChain(retired.swapChain);
+    createImageViews();
+    createPresentSemaphores();
 
-    cleanupSwapChain();
+    if (swapChainExtent.width > depthExtent.width || swapChainExtent.height > depthExtent.height)
+    {
+      retired.depthImage = depthImage;
+      retired.depthImageView = depthImageView;
+      retired.depthImageAllocation = depthImageAllocation;
+      createDepthResources();
+    }
 
-    createSwapChain();
-    createImageViews();
-    createDepthResources();
     createFramebuffers();
+
+    if (options.cacheCommandBuffers)
+    {
+      createCachedCommandBuffers();
+    }
+
+    retiredSwapChains.push_back(std::move(retired));
+
+    if (options.benchmarkFrames > 0)
+    {
+      cpuTimings.record("swapchainRecreate", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+
+  void destroyRetiredSwapChain(RetiredSwapChain &retired)
+  {
+    if (!retired.commandBuffers.empty())
+    {
+      vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(retired.commandBuffers.size()), retired.commandBuffers.data());
+    }
+
+    for (auto framebuffer : retired.framebuffers)
+    {
+      vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+
+    for (auto imageView : retired.imageViews)
+    {
+      vkDestroyImageView(device, imageView, nullptr);
+    }
+
+    for (auto semaphore : retired.presentSemaphores)
+    {
+      vkDestroySemaphore(device, semaphore, nullptr);
+    }
+
+    if (retired.depthImage != VK_NULL_HANDLE)
+    {
+      vkDestroyImageView(device, retired.depthImageView, nullptr);
+      vkDestroyImage(device, retired.depthImage, nullptr);
+      allocator.free(retired.depthImageAllocation);
+    }
+
+    vkDestroySwapchainKHR(device, retired.swapChain, nullptr);
+  }
+
+  // Destroys the retired swap chains no frame in flight can still refer to.
+  void releaseRetiredSwapChains()
+  {
+    uint64_t completed = completedSubmission();
+    auto released = std::remove_if(retiredSwapChains.begin(), retiredSwapChains.end(), [&](RetiredSwapChain &retired)
+                                   {
+                                     if (retired.lastSubmission > completed)
+                                       return false;
+                                     destroyRetiredSwapChain(retired);
+                                     return true; });
+    retiredSwapChains.erase(released, retiredSwapChains.end());
   }
 
   void createInstance()
@@ -384,7 +4620,7 @@ private:
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = VK_API_VERSION_1_2;
 
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -441,6 +4677,9 @@ private:
 
   void createSurface()
   {
+    if (options.headless)
+      return;
+
     if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
     {
       throw std::runtime_error("failed to create window surface!");
@@ -480,7 +4719,7 @@ private:
     QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value(), indices.transferFamily.value()};
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -493,8 +4732,25 @@ private:
       queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    samplerAnisotropySupported = supportedFeatures.samplerAnisotropy == VK_TRUE;
+
+    fillModeNonSolidSupported = supportedFeatures.fillModeNonSolid == VK_TRUE;
+
+    // The feedback is written from the fragment shader.
+    virtualTexturing = options.virtualTexture && supportedFeatures.fragmentStoresAndAtomics == VK_TRUE;
+    if (options.virtualTexture && !virtualTexturing)
+    {
+      std::cerr << "virtual texturing needs fragmentStoresAndAtomics, uploading the whole texture instead" << std::endl;
+    }
+
     VkPhysicalDeviceFeatures deviceFeatures{};
-    deviceFeatures.samplerAnisotropy = VK_TRUE;
+    deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+    deviceFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid;
+    deviceFeatures.fragmentStoresAndAtomics = virtualTexturing ? VK_TRUE : VK_FALSE;
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
 
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -504,6 +4760,52 @@ private:
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+    createInfo.pNext = &vulkan12Features;
+
+    if (options.bindless)
+    {
+      bindlessMaterials = descriptorIndexingSupported();
+      if (bindlessMaterials)
+      {
+        vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+        vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+        vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+      }
+      else
+      {
+        std::cerr << "bindless materials need descriptor indexing, binding the single texture instead" << std::endl;
+      }
+    }
+
+    auto deviceExtensions = getRequiredDeviceExtensions();
+    pipelineCreationFeedbackSupported = deviceExtensionSupported(physicalDevice, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    if (pipelineCreationFeedbackSupported)
+    {
+      deviceExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    }
+
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+    libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    graphicsPipelineLibrarySupported = deviceExtensionSupported(physicalDevice, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+                                       deviceExtensionSupported(physicalDevice, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+    if (graphicsPipelineLibrarySupported)
+    {
+      VkPhysicalDeviceFeatures2 features2{};
+      features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+      features2.pNext = &libraryFeatures;
+      vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+      graphicsPipelineLibrarySupported = libraryFeatures.graphicsPipelineLibrary == VK_TRUE;
+    }
+    if (graphicsPipelineLibrarySupported)
+    {
+      deviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+      deviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+      vulkan12Features.pNext = &libraryFeatures;
+    }
     createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
     createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
@@ -524,17 +4826,63 @@ private:
 
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+    allocator.init(physicalDevice, device);
+    uploads.init(physicalDevice, device, allocator, indices.transferFamily.value(), indices.graphicsFamily.value());
   }
 
-  void createSwapChain()
+  // Checks the descriptor indexing features bindless.frag relies on and
+  // sizes the material array within the update-after-bind limits.
+  bool descriptorIndexingSupported()
+  {
+    VkPhysicalDeviceVulkan12Features supported{};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &supported;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+    if (supported.runtimeDescriptorArray != VK_TRUE ||
+        supported.descriptorBindingPartiallyBound != VK_TRUE ||
+        supported.descriptorBindingSampledImageUpdateAfterBind != VK_TRUE ||
+        supported.shaderSampledImageArrayNonUniformIndexing != VK_TRUE)
+      return false;
+
+    VkPhysicalDeviceVulkan12Properties limits{};
+    limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &limits;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+    // The limits count every descriptor of the pipeline layout, including
+    // the texture of set 0.
+    const uint32_t setZeroSamplers = 1;
+    uint32_t limit = std::min({limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+                               limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                               limits.maxDescriptorSetUpdateAfterBindSamplers,
+                               limits.maxDescriptorSetUpdateAfterBindSampledImages});
+    if (limit <= setZeroSamplers)
+      return false;
+
+    materialTextureLimit = std::min(MAX_MATERIAL_TEXTURES, limit - setZeroSamplers);
+    return materialTextureLimit > 1;
+  }
+
+  void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE)
   {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
     VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
     VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
     VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+    swapChainPresentMode = presentMode;
 
     uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    if (options.swapchainImages > 0)
+    {
+      imageCount = std::max(options.swapchainImages, swapChainSupport.capabilities.minImageCount);
+    }
     if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
     {
       imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -569,6 +4917,7 @@ private:
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
+    createInfo.oldSwapchain = oldSwapChain;
 
     if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
     {
@@ -579,8 +4928,95 @@ private:
     swapChainImages.resize(imageCount);
     vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
 
-    swapChainImageFormat = surfaceFormat.format;
-    swapChainExtent = extent;
+    swapChainImageFormat = surfaceFormat.format;
+    swapChainExtent = extent;
+  }
+
+  void createOffscreenTargets()
+  {
+    swapChainImageFormat = findSupportedFormat(
+        {VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_SRGB},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+    swapChainExtent = {WIDTH, HEIGHT};
+
+    swapChainImages.resize(framesInFlight);
+    offscreenImageAllocations.resize(framesInFlight);
+
+    for (size_t i = 0; i < framesInFlight; i++)
+    {
+      createImage(swapChainExtent.width, swapChainExtent.height, 1, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImageAllocations[i]);
+    }
+  }
+
+  void saveOffscreenImage(uint32_t imageIndex, const std::string &path)
+  {
+    VkDeviceSize imageSize = swapChainExtent.width * swapChainExtent.height * 4;
+
+    VkBuffer readbackBuffer;
+    Allocation readbackBufferAllocation;
+    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferAllocation);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+
+    vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = readbackBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        0, nullptr,
+        1, &barrier,
+        0, nullptr);
+
+    endSingleTimeCommands(commandBuffer);
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+      vkDestroyBuffer(device, readbackBuffer, nullptr);
+      allocator.free(readbackBufferAllocation);
+      throw std::runtime_error("failed to open output image!");
+    }
+
+    file << "P6\n"
+         << swapChainExtent.width << " " << swapChainExtent.height << "\n255\n";
+
+    bool swizzle = swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+    const uint8_t *pixels = static_cast<const uint8_t *>(readbackBufferAllocation.mapped);
+    std::vector<char> row(swapChainExtent.width * 3);
+    for (uint32_t y = 0; y < swapChainExtent.height; y++)
+    {
+      for (uint32_t x = 0; x < swapChainExtent.width; x++)
+      {
+        const uint8_t *pixel = pixels + (y * swapChainExtent.width + x) * 4;
+        row[x * 3 + 0] = static_cast<char>(swizzle ? pixel[2] : pixel[0]);
+        row[x * 3 + 1] = static_cast<char>(pixel[1]);
+        row[x * 3 + 2] = static_cast<char>(swizzle ? pixel[0] : pixel[2]);
+      }
+      file.write(row.data(), row.size());
+    }
+
+    vkDestroyBuffer(device, readbackBuffer, nullptr);
+    allocator.free(readbackBufferAllocation);
   }
 
   void createImageViews()
@@ -589,7 +5025,7 @@ private:
 
     for (uint32_t i = 0; i < swapChainImages.size(); i++)
     {
-      swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+      swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
     }
   }
 
@@ -603,7 +5039,7 @@ private:
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = findDepthFormat();
@@ -637,6 +5073,21 @@ private:
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+    std::vector<VkSubpassDependency> dependencies = {dependency};
+
+    if (options.headless)
+    {
+      // Offscreen targets may be copied out after the pass (see saveOffscreenImage).
+      VkSubpassDependency readbackDependency{};
+      readbackDependency.srcSubpass = 0;
+      readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+      readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      dependencies.push_back(readbackDependency);
+    }
+
     std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -644,8 +5095,8 @@ private:
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
     {
@@ -658,7 +5109,7 @@ private:
     VkDescriptorSetLayoutBinding uboLayoutBinding{};
     uboLayoutBinding.binding = 0;
     uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.pImmutableSamplers = nullptr;
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -669,7 +5120,24 @@ private:
     samplerLayoutBinding.pImmutableSamplers = nullptr;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+    std::vector<VkDescriptorSetLayoutBinding> bindings = {uboLayoutBinding, samplerLayoutBinding};
+    if (virtualTexturing)
+    {
+      VkDescriptorSetLayoutBinding pageTableLayoutBinding{};
+      pageTableLayoutBinding.binding = 2;
+      pageTableLayoutBinding.descriptorCount = 1;
+      pageTableLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      pageTableLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+      bindings.push_back(pageTableLayoutBinding);
+
+      VkDescriptorSetLayoutBinding feedbackLayoutBinding{};
+      feedbackLayoutBinding.binding = 3;
+      feedbackLayoutBinding.descriptorCount = 1;
+      feedbackLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      feedbackLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+      bindings.push_back(feedbackLayoutBinding);
+    }
+
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -679,131 +5147,599 @@ private:
     {
       throw std::runtime_error("failed to create descriptor set layout!");
     }
+
+    if (bindlessMaterials)
+    {
+      createMaterialDescriptorSetLayout();
+    }
   }
 
-  void createGraphicsPipeline()
+  // Only the materials the model has are written, and the array can be
+  // updated while the set is bound.
+  void createMaterialDescriptorSetLayout()
   {
-    auto vertShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
+    VkDescriptorSetLayoutBinding materialLayoutBinding{};
+    materialLayoutBinding.binding = 0;
+    materialLayoutBinding.descriptorCount = materialTextureLimit;
+    materialLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    materialLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
 
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &materialLayoutBinding;
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main";
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &materialDescriptorSetLayout) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create material descriptor set layout!");
+    }
+  }
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
+  void createGraphicsPipeline()
+  {
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(VertexDequantization);
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    std::array<VkDescriptorSetLayout, 2> setLayouts = {descriptorSetLayout, materialDescriptorSetLayout};
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = bindlessMaterials ? 2 : 1;
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create pipeline layout!");
+    }
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    pipelineLinker = std::make_unique<ThreadPool>(1);
+    if (graphicsPipelineLibrarySupported)
+    {
+      pipelineLibraries = buildPipelineLibraries();
+    }
 
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    if (!useRenderMode(options.renderMode))
+    {
+      useRenderMode(0);
+    }
+    if (!pipelineLibraries)
+    {
+      queuePipelineBuilds();
+    }
+  }
 
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+  // Virtual textures are sampled through the page table by virtual.frag,
+  // material textures through the bindless array by bindless.frag.
+  std::string fragmentShaderPath() const
+  {
+    if (virtualTexturing)
+      return "shaders/virtual.frag.spv";
+    if (bindlessMaterials)
+      return "shaders/bindless.frag.spv";
+    return "shaders/frag.spv";
+  }
 
-    VkPipelineViewportStateCreateInfo viewportState{};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.scissorCount = 1;
+  std::string fragmentShaderSource() const
+  {
+    if (virtualTexturing)
+      return SHADER_SOURCE_DIR "/virtual.frag";
+    if (bindlessMaterials)
+      return SHADER_SOURCE_DIR "/bindless.frag";
+    return SHADER_SOURCE_DIR "/shader.frag";
+  }
 
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
+  bool renderModeSupported(const RenderMode &mode) const
+  {
+    return mode.polygonMode == VK_POLYGON_MODE_FILL || fillModeNonSolidSupported;
+  }
 
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  // Builds every library part the supported render modes need from the
+  // current SPIR-V files. Also runs on the shader reload thread.
+  std::shared_ptr<GraphicsPipelineLibraries> buildPipelineLibraries()
+  {
+    auto libraries = std::make_shared<GraphicsPipelineLibraries>(device);
 
-    VkPipelineDepthStencilStateCreateInfo depthStencil{};
-    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.stencilTestEnable = VK_FALSE;
+    VkShaderModule vertShaderModule = createShaderModule(readFile("shaders/vert.spv"));
+    VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+    try
+    {
+      fragShaderModule = createShaderModule(readFile(fragmentShaderPath()));
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+      for (const auto &mode : RENDER_MODES)
+      {
+        if (!renderModeSupported(mode))
+          continue;
 
-    VkPipelineColorBlendStateCreateInfo colorBlending{};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f;
-    colorBlending.blendConstants[1] = 0.0f;
-    colorBlending.blendConstants[2] = 0.0f;
-    colorBlending.blendConstants[3] = 0.0f;
+        GraphicsPipelineState state(mode, vertShaderModule, fragShaderModule);
 
-    std::vector<VkDynamicState> dynamicStates = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR};
-    VkPipelineDynamicStateCreateInfo dynamicState{};
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-    dynamicState.pDynamicStates = dynamicStates.data();
+        if (libraries->vertexInput == VK_NULL_HANDLE)
+        {
+          createPipeline("vertex input library", state.library(VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT, pipelineLayout, renderPass), libraries->vertexInput);
+        }
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+        VkPipeline &preRasterization = libraries->preRasterization[{mode.cullMode, mode.polygonMode}];
+        if (preRasterization == VK_NULL_HANDLE)
+        {
+          createPipeline("pre-rasterization library", state.library(VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT, pipelineLayout, renderPass), preRasterization);
+        }
 
-    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+        VkPipeline &fragmentShader = libraries->fragmentShader[{mode.shading, mode.blend}];
+        if (fragmentShader == VK_NULL_HANDLE)
+        {
+          createPipeline("fragment shader library", state.library(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT, pipelineLayout, renderPass), fragmentShader);
+        }
+
+        VkPipeline &fragmentOutput = libraries->fragmentOutput[mode.blend];
+        if (fragmentOutput == VK_NULL_HANDLE)
+        {
+          createPipeline("fragment output library", state.library(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT, pipelineLayout, renderPass), fragmentOutput);
+        }
+      }
+    }
+    catch (...)
     {
-      throw std::runtime_error("failed to create pipeline layout!");
+      vkDestroyShaderModule(device, fragShaderModule, nullptr);
+      vkDestroyShaderModule(device, vertShaderModule, nullptr);
+      throw;
     }
 
+    vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    return libraries;
+  }
+
+  // Links a render mode's pipeline from library parts. A fast link takes
+  // about as long as a draw call's worth of CPU time; an optimized link is
+  // as fast to render with as a pipeline built in one piece.
+  VkPipeline linkRenderMode(const GraphicsPipelineLibraries &libraries, uint32_t mode, bool optimize)
+  {
+    auto parts = libraries.parts(RENDER_MODES[mode]);
+
+    VkPipelineLibraryCreateInfoKHR libraryInfo{};
+    libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    libraryInfo.libraryCount = static_cast<uint32_t>(parts.size());
+    libraryInfo.pLibraries = parts.data();
+
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = &depthStencil;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.pNext = &libraryInfo;
+    if (optimize)
+    {
+      pipelineInfo.flags |= VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT;
+    }
     pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+    std::string name = std::string(RENDER_MODES[mode].name) + (optimize ? " optimized" : " fast-linked");
+    VkPipeline pipeline;
+    createPipeline(name.c_str(), pipelineInfo, pipeline);
+    return pipeline;
+  }
+
+  // Builds a render mode's pipeline in one piece from the current SPIR-V
+  // files, on devices without graphics pipeline libraries.
+  VkPipeline buildGraphicsPipeline(uint32_t mode)
+  {
+    VkShaderModule vertShaderModule = createShaderModule(readFile("shaders/vert.spv"));
+    VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    try
+    {
+      fragShaderModule = createShaderModule(readFile(fragmentShaderPath()));
+
+      GraphicsPipelineState state(RENDER_MODES[mode], vertShaderModule, fragShaderModule);
+      createPipeline(RENDER_MODES[mode].name, state.complete(pipelineLayout, renderPass), pipeline);
+    }
+    catch (...)
+    {
+      vkDestroyShaderModule(device, fragShaderModule, nullptr);
+      vkDestroyShaderModule(device, vertShaderModule, nullptr);
+      throw;
+    }
+
+    vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    return pipeline;
+  }
+
+  // Rebuilds the pipelines from changed shaders on the shader reload thread.
+  // With libraries only the parts are built here, plus a fast link of the
+  // current mode; swapReloadedPipeline() installs both.
+  VkPipeline rebuildGraphicsPipeline()
+  {
+    uint32_t mode = renderMode;
+    if (!graphicsPipelineLibrarySupported)
+    {
+      VkPipeline pipeline = buildGraphicsPipeline(mode);
+      std::lock_guard<std::mutex> lock(pipelineMutex);
+      reloadedRenderMode = mode;
+      return pipeline;
+    }
+
+    auto libraries = buildPipelineLibraries();
+    VkPipeline pipeline = linkRenderMode(*libraries, mode, false);
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    reloadedLibraries = std::move(libraries);
+    reloadedRenderMode = mode;
+    return pipeline;
+  }
+
+  // Switches to a render mode. The first time a mode is used its pipeline
+  // is linked from the libraries, which is quick, and an optimized link is
+  // queued on the linker thread to replace it. Without libraries the linker
+  // thread builds every mode at startup, and a mode used before its build
+  // finished is built here. Returns false for modes the device lacks.
+  bool useRenderMode(uint32_t mode)
+  {
+    if (!renderModeSupported(RENDER_MODES[mode]))
+    {
+      std::cerr << "render mode " << RENDER_MODES[mode].name << " is not supported by this device" << std::endl;
+      return false;
+    }
+
+    renderMode = mode;
+    VkPipeline &pipeline = renderModePipelines[mode];
+    if (pipeline == VK_NULL_HANDLE)
+    {
+      if (pipelineLibraries)
+      {
+        pipeline = linkRenderMode(*pipelineLibraries, mode, false);
+        queueOptimizedLink(mode);
+      }
+      else
+      {
+        pipeline = buildGraphicsPipeline(mode);
+      }
+    }
+
+    graphicsPipeline = pipeline;
+    markSceneDirty();
+    return true;
+  }
+
+  // Without libraries every supported mode not built yet is built on the
+  // linker thread, so switching to it later does not stall a frame.
+  void queuePipelineBuilds()
+  {
+    uint64_t generation = shaderGeneration;
+    for (uint32_t mode = 0; mode < RENDER_MODES.size(); mode++)
+    {
+      if (renderModePipelines[mode] != VK_NULL_HANDLE || !renderModeSupported(RENDER_MODES[mode]))
+        continue;
+
+      pipelineLinker->submit([this, mode, generation]
+                             {
+                               VkPipeline pipeline;
+                               try
+                               {
+                                 pipeline = buildGraphicsPipeline(mode);
+                               }
+                               catch (const std::exception &e)
+                               {
+                                 std::cerr << e.what() << std::endl;
+                                 return;
+                               }
+
+                               std::lock_guard<std::mutex> lock(pipelineMutex);
+                               optimizedPipelines.push_back({mode, generation, pipeline}); });
+    }
+  }
+
+  void queueOptimizedLink(uint32_t mode)
+  {
+    auto libraries = pipelineLibraries;
+    uint64_t generation = shaderGeneration;
+    pipelineLinker->submit([this, libraries, mode, generation]
+                           {
+                             VkPipeline pipeline;
+                             try
+                             {
+                               pipeline = linkRenderMode(*libraries, mode, true);
+                             }
+                             catch (const std::exception &e)
+                             {
+                               std::cerr << e.what() << std::endl;
+                               return;
+                             }
+
+                             std::lock_guard<std::mutex> lock(pipelineMutex);
+                             optimizedPipelines.push_back({mode, generation, pipeline}); });
+  }
+
+  // Replaces fast-linked pipelines with the optimized links that finished
+  // since the last frame, and fills in the modes built ahead of use.
+  void adoptOptimizedPipelines()
+  {
+    std::vector<OptimizedPipeline> finished;
+    {
+      std::lock_guard<std::mutex> lock(pipelineMutex);
+      finished.swap(optimizedPipelines);
+    }
+
+    for (const auto &optimized : finished)
+    {
+      // Linked from shaders a reload has since replaced, and never used.
+      if (optimized.generation != shaderGeneration)
+      {
+        vkDestroyPipeline(device, optimized.pipeline, nullptr);
+        continue;
+      }
+      // Built in one piece on the render thread because the mode was used
+      // before the background build finished; both are the same.
+      if (!pipelineLibraries && renderModePipelines[optimized.mode] != VK_NULL_HANDLE)
+      {
+        vkDestroyPipeline(device, optimized.pipeline, nullptr);
+        continue;
+      }
+
+      retirePipeline(renderModePipelines[optimized.mode]);
+      renderModePipelines[optimized.mode] = optimized.pipeline;
+      if (optimized.mode == renderMode)
+      {
+        graphicsPipeline = optimized.pipeline;
+        markSceneDirty();
+      }
+    }
+  }
+
+  // Keeps a replaced pipeline until the frame timeline passes the last
+  // submission so far, which is the last one that may use it.
+  void retirePipeline(VkPipeline pipeline)
+  {
+    if (pipeline != VK_NULL_HANDLE)
+    {
+      retiredPipelines.push_back({pipeline, submissionCount});
+    }
+  }
+
+  void releaseRetiredPipelines()
+  {
+    uint64_t completed = completedSubmission();
+    auto released = std::remove_if(retiredPipelines.begin(), retiredPipelines.end(), [&](const RetiredPipeline &retired)
+                                   {
+                                     if (retired.lastSubmission > completed)
+                                       return false;
+                                     vkDestroyPipeline(device, retired.pipeline, nullptr);
+                                     return true; });
+    retiredPipelines.erase(released, retiredPipelines.end());
+  }
+
+  void createCullPipeline()
+  {
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); i++)
+    {
+      bindings[i].binding = i;
+      bindings[i].descriptorCount = 1;
+      bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &cullDescriptorSetLayout) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create cull descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullParameters);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create cull pipeline layout!");
+    }
+
+    VkShaderModule cullShaderModule = createShaderModule(readFile("shaders/cull.comp.spv"));
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = cullShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = cullPipelineLayout;
+
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &cullPipeline) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create cull pipeline!");
+    }
+
+    vkDestroyShaderModule(device, cullShaderModule, nullptr);
+  }
+
+  // Reads PIPELINE_CACHE_PATH into the cache if its header matches this
+  // device and driver; anything else starts from an empty cache.
+  void createPipelineCache()
+  {
+    std::vector<char> data = readPipelineCacheFile();
+    pipelineCacheStatistics.loadedBytes = data.size();
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) == VK_SUCCESS)
+      return;
+
+    // The driver can still reject data that passed the header check.
+    pipelineCacheStatistics.loadedBytes = 0;
+    cacheInfo.initialDataSize = 0;
+    cacheInfo.pInitialData = nullptr;
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create pipeline cache!");
+    }
+  }
+
+  // Returns the cache file's contents, or nothing if it is missing or was
+  // written by another device, driver version or cache format.
+  std::vector<char> readPipelineCacheFile()
+  {
+    std::ifstream file(PIPELINE_CACHE_PATH, std::ios::binary);
+    if (!file.is_open())
+      return {};
+    file.close();
+
+    std::vector<char> data = readFile(PIPELINE_CACHE_PATH);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // The header fields are read one by one since the on-disk layout is
+    // packed little-endian 32-bit words followed by the UUID.
+    uint32_t header[4];
+    if (data.size() < sizeof(header) + VK_UUID_SIZE)
+    {
+      std::cerr << PIPELINE_CACHE_PATH << ": truncated header, ignoring" << std::endl;
+      return {};
+    }
+    memcpy(header, data.data(), sizeof(header));
+
+    if (header[0] < sizeof(header) + VK_UUID_SIZE || header[0] > data.size() || header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+    {
+      std::cerr << PIPELINE_CACHE_PATH << ": unknown header version, ignoring" << std::endl;
+      return {};
+    }
+
+    if (header[2] != properties.vendorID || header[3] != properties.deviceID ||
+        memcmp(data.data() + sizeof(header), properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+      std::cerr << PIPELINE_CACHE_PATH << ": written by another device or driver, ignoring" << std::endl;
+      return {};
+    }
+
+    return data;
+  }
+
+  // Merges whatever another run may have saved in the meantime into the
+  // cache and replaces the file via a temporary, so that readers never see a
+  // partially written cache.
+  void savePipelineCache()
+  {
+    std::vector<char> onDisk = readPipelineCacheFile();
+    if (!onDisk.empty())
+    {
+      VkPipelineCacheCreateInfo cacheInfo{};
+      cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+      cacheInfo.initialDataSize = onDisk.size();
+      cacheInfo.pInitialData = onDisk.data();
+
+      VkPipelineCache diskCache;
+      if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &diskCache) == VK_SUCCESS)
+      {
+        vkMergePipelineCaches(device, pipelineCache, 1, &diskCache);
+        vkDestroyPipelineCache(device, diskCache, nullptr);
+      }
+    }
+
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+      return;
+
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+      return;
+
+    std::string temporaryPath = PIPELINE_CACHE_PATH + ".tmp";
+    {
+      std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+      file.write(data.data(), static_cast<std::streamsize>(dataSize));
+      if (!file)
+      {
+        std::cerr << "failed to write " << temporaryPath << std::endl;
+        return;
+      }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, PIPELINE_CACHE_PATH, error);
+    if (error)
+    {
+      std::cerr << "failed to replace " << PIPELINE_CACHE_PATH << ": " << error.message() << std::endl;
+      std::filesystem::remove(temporaryPath, error);
+    }
+  }
+
+  // Creates a graphics pipeline through the pipeline cache and records how
+  // long it took and, where the driver reports it, whether the cache hit.
+  void createPipeline(const char *name, VkGraphicsPipelineCreateInfo pipelineInfo, VkPipeline &pipeline)
+  {
+    VkPipelineCreationFeedbackEXT feedback{};
+    std::vector<VkPipelineCreationFeedbackEXT> stageFeedbacks(pipelineInfo.stageCount);
+
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo{};
+    feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+    feedbackInfo.pNext = pipelineInfo.pNext;
+    feedbackInfo.pPipelineCreationFeedback = &feedback;
+    feedbackInfo.pipelineStageCreationFeedbackCount = pipelineInfo.stageCount;
+    feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedbacks.data();
+    if (pipelineCreationFeedbackSupported)
+    {
+      pipelineInfo.pNext = &feedbackInfo;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
     {
-      throw std::runtime_error("failed to create graphics pipeline!");
+      throw std::runtime_error(std::string("failed to create ") + name + " pipeline!");
     }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-    vkDestroyShaderModule(device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    // Pipelines are also created on the shader reload and linker threads.
+    std::lock_guard<std::mutex> lock(pipelineStatisticsMutex);
+    const char *outcome = "unknown";
+    if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)
+    {
+      if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+      {
+        outcome = "hit";
+        pipelineCacheStatistics.hits++;
+        pipelineCacheStatistics.hitMilliseconds += milliseconds;
+      }
+      else
+      {
+        outcome = "miss";
+        pipelineCacheStatistics.misses++;
+        pipelineCacheStatistics.missMilliseconds += milliseconds;
+      }
+    }
+    else
+    {
+      pipelineCacheStatistics.unknown++;
+      pipelineCacheStatistics.unknownMilliseconds += milliseconds;
+    }
+
+    // Benchmark runs keep stdout for the JSON report.
+    if (options.benchmarkFrames == 0)
+    {
+      std::cout << name << " pipeline: " << milliseconds << " ms (pipeline cache " << outcome << ")" << std::endl;
+    }
   }
 
   void createFramebuffers()
@@ -851,8 +5787,9 @@ private:
   {
     VkFormat depthFormat = findDepthFormat();
 
-    createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-    depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+    createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageAllocation);
+    depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+    depthExtent = swapChainExtent;
   }
 
   VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
@@ -890,39 +5827,452 @@ private:
 
   void createTextureImage()
   {
-    int texWidth, texHeight, texChannels;
-    stbi_uc *pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    if (createCompressedTextureImage())
+      return;
+
+    // Only decoded up front when no compressed texture could be read.
+    DecodedImage image = decodedTexture.pixels ? std::move(decodedTexture) : decodeImage(TEXTURE_PATH);
+    mipLevels = uploadRgbaTexture(std::move(image), textureImage, textureImageAllocation);
+    uploads.flush();
+  }
 
-    if (!pixels)
+  // Stages RGBA8 texels for an sRGB image with a full mip chain and returns
+  // its level count. The caller flushes the uploads.
+  uint32_t uploadRgbaTexture(DecodedImage image, VkImage &target, Allocation &allocation)
+  {
+    int texWidth = image.width;
+    int texHeight = image.height;
+
+    uint32_t levelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+
+    // Blitting needs linear filtering support for the format; without it the
+    // whole chain is built on the CPU and uploaded at once.
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+    bool blitMipmaps = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) &&
+                       (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+                       (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+
+    uint32_t uploadLevels = blitMipmaps ? 1 : levelCount;
+    std::vector<VkDeviceSize> levelOffsets;
+    VkDeviceSize imageSize = 0;
+    for (uint32_t level = 0; level < uploadLevels; level++)
     {
-      throw std::runtime_error("failed to load texture image!");
+      levelOffsets.push_back(imageSize);
+      imageSize += static_cast<VkDeviceSize>(std::max(texWidth >> level, 1)) * std::max(texHeight >> level, 1) * 4;
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    UploadEngine::StagingSpan staging = uploads.stage(imageSize);
 
-    void *data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+    uint8_t *level = static_cast<uint8_t *>(staging.data);
+    memcpy(level, image.pixels.get(), static_cast<size_t>(texWidth) * texHeight * 4);
+    image.pixels.reset();
+
+    for (uint32_t i = 1; i < uploadLevels; i++)
+    {
+      uint32_t width = std::max(texWidth >> (i - 1), 1);
+      uint32_t height = std::max(texHeight >> (i - 1), 1);
+      uint8_t *next = level + static_cast<size_t>(width) * height * 4;
+      downsampleRgba8(level, width, height, next);
+      level = next;
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (blitMipmaps)
+    {
+      usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    createImage(texWidth, texHeight, levelCount, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target, allocation);
+
+    auto regions = mipCopyRegions(static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), levelOffsets);
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1};
+
+    if (blitMipmaps)
+    {
+      // The blits run on the graphics queue once it owns the image.
+      uploads.copyToImage(staging, target, range, regions, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+      uploads.onGraphicsQueue([this, target, texWidth, texHeight, levelCount](VkCommandBuffer commandBuffer)
+                              { generateMipmaps(commandBuffer, target, texWidth, texHeight, levelCount); });
+    }
+    else
+    {
+      uploads.copyToImage(staging, target, range, regions, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+
+    return levelCount;
+  }
+
+  // Reads the textures on a startup worker before the device exists: every
+  // entry of COMPRESSED_TEXTURE_PATHS that parses, or else TEXTURE_PATH.
+  // Virtual textures are cut into pages from RGBA8 texels, so they always
+  // use TEXTURE_PATH.
+  void decodeTexture()
+  {
+    for (const auto &path : COMPRESSED_TEXTURE_PATHS)
+    {
+      if (options.virtualTexture)
+        break;
+
+      std::ifstream file(path, std::ios::binary);
+      if (!file.is_open())
+        continue;
+      file.close();
+
+      try
+      {
+        compressedTextures.push_back(parseKtx2(readFile(path)));
+      }
+      catch (const std::runtime_error &e)
+      {
+        std::cerr << path << ": " << e.what() << std::endl;
+      }
+    }
+
+    if (compressedTextures.empty())
+    {
+      decodedTexture = decodeImage(TEXTURE_PATH);
+    }
+  }
+
+  // Decodes the diffuse textures loadModel() found, on a startup worker.
+  // Unreadable ones keep their element, empty, so the vertices' material
+  // indices stay valid.
+  void decodeMaterials()
+  {
+    decodedMaterials.resize(materialTexturePaths.size());
+    for (size_t i = 0; i < materialTexturePaths.size(); i++)
+    {
+      try
+      {
+        decodedMaterials[i] = decodeImage(materialTexturePaths[i]);
+      }
+      catch (const std::runtime_error &e)
+      {
+        std::cerr << materialTexturePaths[i] << ": " << e.what() << std::endl;
+      }
+    }
+  }
+
+  // Uploads the decoded materials as elements 1 and up of the bindless
+  // array, as many as it has room for.
+  void createMaterialTextures()
+  {
+    if (!bindlessMaterials)
+    {
+      decodedMaterials.clear();
+      return;
+    }
+
+    // Materials past what the device can bind fall back to element 0; the
+    // vertices are still on the CPU, as the mesh upload waits for this.
+    if (decodedMaterials.size() >= materialTextureLimit)
+    {
+      decodedMaterials.resize(materialTextureLimit - 1);
+      for (auto &vertex : vertices)
+      {
+        if (vertex.material >= materialTextureLimit)
+        {
+          vertex.material = 0;
+        }
+      }
+    }
+
+    // All materials go out in one submission.
+    materialTextures.resize(decodedMaterials.size());
+    std::vector<uint32_t> levels(decodedMaterials.size(), 0);
+    for (size_t i = 0; i < decodedMaterials.size(); i++)
+    {
+      if (decodedMaterials[i].pixels)
+      {
+        levels[i] = uploadRgbaTexture(std::move(decodedMaterials[i]), materialTextures[i].image, materialTextures[i].allocation);
+      }
+    }
+    uploads.flush();
+    decodedMaterials.clear();
+
+    for (size_t i = 0; i < materialTextures.size(); i++)
+    {
+      if (materialTextures[i].image != VK_NULL_HANDLE)
+      {
+        materialTextures[i].view = createImageView(materialTextures[i].image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, levels[i]);
+      }
+    }
+  }
+
+  // Number of elements of the material array that are written.
+  uint32_t materialCount() const
+  {
+    return 1 + static_cast<uint32_t>(materialTextures.size());
+  }
+
+  // Uploads the first decoded compressed texture whose format the device
+  // can sample as is, mip levels included. Returns false when none applies
+  // so that the caller uploads TEXTURE_PATH instead.
+  bool createCompressedTextureImage()
+  {
+    std::vector<Ktx2Texture> textures = std::move(compressedTextures);
+    for (const auto &texture : textures)
+    {
+      VkFormatProperties formatProperties;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, texture.format, &formatProperties);
+      if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) ||
+          !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+        continue;
+
+      VkDeviceSize imageSize = 0;
+      for (const auto &level : texture.levels)
+      {
+        imageSize += level.size;
+      }
+
+      UploadEngine::StagingSpan staging = uploads.stage(imageSize);
+
+      std::vector<VkDeviceSize> levelOffsets;
+      VkDeviceSize stagingOffset = 0;
+      for (const auto &level : texture.levels)
+      {
+        memcpy(static_cast<char *>(staging.data) + stagingOffset, texture.data.data() + level.offset, level.size);
+        levelOffsets.push_back(stagingOffset);
+        stagingOffset += level.size;
+      }
 
-    stbi_image_free(pixels);
+      textureFormat = texture.format;
+      mipLevels = static_cast<uint32_t>(texture.levels.size());
 
-    createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+      createImage(texture.width, texture.height, mipLevels, textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageAllocation);
 
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+      uploads.copyToImage(staging, textureImage, range, mipCopyRegions(texture.width, texture.height, levelOffsets), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+      uploads.flush();
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+      return true;
+    }
+
+    return false;
+  }
+
+  // Records blits filling levels 1..mipLevels-1 each from the previous
+  // one, leaving the whole image in SHADER_READ_ONLY_OPTIMAL.
+  void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+  {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.levelCount = 1;
+
+    int32_t mipWidth = texWidth;
+    int32_t mipHeight = texHeight;
+
+    for (uint32_t i = 1; i < mipLevels; i++)
+    {
+      barrier.subresourceRange.baseMipLevel = i - 1;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+      vkCmdPipelineBarrier(commandBuffer,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                           0, nullptr,
+                           0, nullptr,
+                           1, &barrier);
+
+      VkImageBlit blit{};
+      blit.srcOffsets[0] = {0, 0, 0};
+      blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.srcSubresource.mipLevel = i - 1;
+      blit.srcSubresource.baseArrayLayer = 0;
+      blit.srcSubresource.layerCount = 1;
+      blit.dstOffsets[0] = {0, 0, 0};
+      blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
+      blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.dstSubresource.mipLevel = i;
+      blit.dstSubresource.baseArrayLayer = 0;
+      blit.dstSubresource.layerCount = 1;
+
+      vkCmdBlitImage(commandBuffer,
+                     image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     1, &blit,
+                     VK_FILTER_LINEAR);
+
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(commandBuffer,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                           0, nullptr,
+                           0, nullptr,
+                           1, &barrier);
+
+      if (mipWidth > 1)
+        mipWidth /= 2;
+      if (mipHeight > 1)
+        mipHeight /= 2;
+    }
+
+    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr,
+                         0, nullptr,
+                         1, &barrier);
   }
 
   void createTextureImageView()
   {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+    textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+  }
+
+  // Creates the physical page cache as textureImage, the page table and the
+  // per-frame buffers. Nothing is uploaded here: the coarsest page and the
+  // first page table go in with the first frame.
+  void createVirtualTexture()
+  {
+    DecodedImage image = decodedTexture.pixels ? std::move(decodedTexture) : decodeImage(TEXTURE_PATH);
+    virtualTexture = std::make_unique<VirtualTexture>(std::move(image));
+
+    mipLevels = 1;
+    uint32_t cacheTexels = VT_CACHE_PAGES_PER_SIDE * VT_SLOT_TEXELS;
+    createImage(cacheTexels, cacheTexels, 1, textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageAllocation);
+    textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+    uint32_t levels = virtualTexture->levelCount();
+    createImage(virtualTexture->pageTableWidth(), virtualTexture->pageTableHeight(), levels, VK_FORMAT_R32_UINT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pageTableImage, pageTableAllocation);
+    pageTableImageView = createImageView(pageTableImage, VK_FORMAT_R32_UINT, VK_IMAGE_ASPECT_COLOR_BIT, levels);
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod = static_cast<float>(levels);
+
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &pageTableSampler) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create page table sampler!");
+    }
+
+    VkDeviceSize feedbackSize = sizeof(VirtualTextureFeedbackHeader) + virtualTexture->pageCount() * sizeof(uint32_t);
+    VkDeviceSize stagingSize = VT_UPLOADS_PER_FRAME * VT_SLOT_TEXELS * VT_SLOT_TEXELS * 4 + virtualTexture->pageCount() * sizeof(uint32_t);
+    feedbackBuffers.resize(framesInFlight);
+    feedbackAllocations.resize(framesInFlight);
+    pageStagingBuffers.resize(framesInFlight);
+    pageStagingAllocations.resize(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+      createBuffer(feedbackSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, feedbackBuffers[i], feedbackAllocations[i]);
+      memset(feedbackAllocations[i].mapped, 0, feedbackSize);
+      virtualTexture->writeFeedbackHeader(*static_cast<VirtualTextureFeedbackHeader *>(feedbackAllocations[i].mapped));
+
+      createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, pageStagingBuffers[i], pageStagingAllocations[i]);
+    }
+  }
+
+  // Hands the pages flagged by this frame slot's last submission, which has
+  // completed, to the virtual texture and clears the flags.
+  void collectVirtualTextureFeedback(uint32_t frame)
+  {
+    uint32_t *flags = reinterpret_cast<uint32_t *>(static_cast<char *>(feedbackAllocations[frame].mapped) + sizeof(VirtualTextureFeedbackHeader));
+    virtualTexture->request(flags, submissionCount + 1);
+    memset(flags, 0, virtualTexture->pageCount() * sizeof(uint32_t));
+  }
+
+  // Records the copies of newly placed pages into the cache and of a
+  // changed page table. Earlier frames only read both images in fragment
+  // shaders, which the barriers wait for, so pages can be replaced under
+  // frames still in flight.
+  void recordVirtualTextureUpdates(VkCommandBuffer commandBuffer, const std::vector<VirtualTexture::Tile> &tiles, const std::vector<uint32_t> &pageTable)
+  {
+    char *staging = static_cast<char *>(pageStagingAllocations[currentFrame].mapped);
+    VkDeviceSize offset = 0;
+
+    std::vector<VkBufferImageCopy> tileRegions;
+    for (const auto &tile : tiles)
+    {
+      memcpy(staging + offset, tile.texels.data(), tile.texels.size());
+
+      VkBufferImageCopy region{};
+      region.bufferOffset = offset;
+      region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+      region.imageOffset = {static_cast<int32_t>(tile.slot % VT_CACHE_PAGES_PER_SIDE * VT_SLOT_TEXELS), static_cast<int32_t>(tile.slot / VT_CACHE_PAGES_PER_SIDE * VT_SLOT_TEXELS), 0};
+      region.imageExtent = {VT_SLOT_TEXELS, VT_SLOT_TEXELS, 1};
+      tileRegions.push_back(region);
+      offset += tile.texels.size();
+    }
+
+    std::vector<VkDeviceSize> levelOffsets;
+    if (!pageTable.empty())
+    {
+      memcpy(staging + offset, pageTable.data(), pageTable.size() * sizeof(uint32_t));
+      for (uint32_t level = 0; level < virtualTexture->levelCount(); level++)
+      {
+        levelOffsets.push_back(offset + virtualTexture->levelOffset(level) * sizeof(uint32_t));
+      }
+    }
+
+    std::vector<VkImageMemoryBarrier> barriers;
+    auto addBarrier = [&](VkImage image, uint32_t levelCount, VkImageLayout &layout)
+    {
+      VkImageMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.oldLayout = layout;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = image;
+      barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1};
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barriers.push_back(barrier);
+      layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    };
+    if (!tileRegions.empty())
+    {
+      addBarrier(textureImage, 1, pageCacheLayout);
+    }
+    if (!levelOffsets.empty())
+    {
+      addBarrier(pageTableImage, virtualTexture->levelCount(), pageTableLayout);
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    if (!tileRegions.empty())
+    {
+      vkCmdCopyBufferToImage(commandBuffer, pageStagingBuffers[currentFrame], textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(tileRegions.size()), tileRegions.data());
+    }
+    if (!levelOffsets.empty())
+    {
+      auto regions = mipCopyRegions(virtualTexture->pageTableWidth(), virtualTexture->pageTableHeight(), levelOffsets);
+      vkCmdCopyBufferToImage(commandBuffer, pageStagingBuffers[currentFrame], pageTableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    }
+
+    for (auto &barrier : barriers)
+    {
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
   }
 
   void createTextureSampler()
@@ -937,13 +6287,18 @@ private:
     samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = properties.limits.maxSamplerAnisotropy;
+    samplerInfo.anisotropyEnable = samplerAnisotropySupported ? VK_TRUE : VK_FALSE;
+    samplerInfo.maxAnisotropy = samplerAnisotropySupported ? properties.limits.maxSamplerAnisotropy : 1.0f;
     samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
     samplerInfo.unnormalizedCoordinates = VK_FALSE;
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.minLod = 0.0f;
+    // Material textures have level counts of their own, which their views
+    // already clamp to.
+    samplerInfo.maxLod = bindlessMaterials ? VK_LOD_CLAMP_NONE : static_cast<float>(mipLevels);
+    samplerInfo.mipLodBias = 0.0f;
 
     if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
     {
@@ -951,7 +6306,7 @@ private:
     }
   }
 
-  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
   {
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -960,7 +6315,7 @@ private:
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectFlags;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -973,7 +6328,7 @@ private:
     return imageView;
   }
 
-  void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image, VkDeviceMemory &imageMemory)
+  void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image, Allocation &imageAllocation)
   {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -981,7 +6336,7 @@ private:
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
@@ -992,239 +6347,548 @@ private:
 
     if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
     {
-      throw std::runtime_error("failed to create image!");
+      throw std::runtime_error("failed to create image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    uint32_t memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    imageAllocation = allocator.allocate(memRequirements, memoryTypeIndex, tiling == VK_IMAGE_TILING_LINEAR);
+
+    vkBindImageMemory(device, image, imageAllocation.memory, imageAllocation.offset);
+  }
+
+  // Copy regions for tightly packed mip levels starting at `levelOffsets`,
+  // largest level first.
+  static std::vector<VkBufferImageCopy> mipCopyRegions(uint32_t width, uint32_t height, const std::vector<VkDeviceSize> &levelOffsets)
+  {
+    uint32_t levelCount = static_cast<uint32_t>(levelOffsets.size());
+    std::vector<VkBufferImageCopy> regions(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+      uint32_t levelWidth = std::max(width >> level, 1u);
+      uint32_t levelHeight = std::max(height >> level, 1u);
+
+      VkBufferImageCopy &region = regions[level];
+      region.bufferOffset = levelOffsets[level];
+      region.bufferRowLength = 0;
+      region.bufferImageHeight = 0;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.mipLevel = level;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset = {0, 0, 0};
+      region.imageExtent = {
+          levelWidth,
+          levelHeight,
+          1};
+    }
+
+    return regions;
+  }
+
+  void loadModel()
+  {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+
+    std::string modelDirectory = std::filesystem::path(MODEL_PATH).parent_path().string() + "/";
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str(), modelDirectory.c_str()))
+    {
+      throw std::runtime_error(warn + err);
+    }
+
+    std::vector<uint32_t> materialElements = materialArrayElements(materials, modelDirectory);
+    auto faceMaterial = [&](const tinyobj::shape_t &shape, size_t index)
+    {
+      size_t face = index / 3;
+      if (face >= shape.mesh.material_ids.size())
+        return 0u;
+      int id = shape.mesh.material_ids[face];
+      return id >= 0 && static_cast<size_t>(id) < materialElements.size() ? materialElements[id] : 0u;
+    };
+
+    size_t indexCount = 0;
+    for (const auto &shape : shapes)
+    {
+      indexCount += shape.mesh.indices.size();
+    }
+
+    if (options.dedupThreads > 1)
+    {
+      std::vector<tinyobj::index_t> objIndices;
+      std::vector<uint32_t> objMaterials;
+      objIndices.reserve(indexCount);
+      objMaterials.reserve(indexCount);
+      for (const auto &shape : shapes)
+      {
+        objIndices.insert(objIndices.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+        for (size_t i = 0; i < shape.mesh.indices.size(); i++)
+        {
+          objMaterials.push_back(faceMaterial(shape, i));
+        }
+      }
+
+      deduplicateVerticesParallel(attrib, objIndices, objMaterials);
+      return;
+    }
+
+    VertexDeduplicator uniqueVertices(indexCount);
+    indices.reserve(indexCount);
+
+    for (const auto &shape : shapes)
+    {
+      for (size_t i = 0; i < shape.mesh.indices.size(); i++)
+      {
+        Vertex vertex = makeVertex(attrib, shape.mesh.indices[i], faceMaterial(shape, i));
+        indices.push_back(uniqueVertices.insert(vertex, hashVertex(vertex), vertices));
+      }
+    }
+  }
+
+  // Maps every OBJ material to its element of the material array and
+  // collects the textures behind elements 1 and up in materialTexturePaths.
+  // Materials without a diffuse texture of their own, and any past the
+  // array's upper bound, use element 0, which is TEXTURE_PATH.
+  std::vector<uint32_t> materialArrayElements(const std::vector<tinyobj::material_t> &materials, const std::string &modelDirectory)
+  {
+    std::vector<uint32_t> elements(materials.size(), 0);
+    if (!options.bindless)
+      return elements;
+
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+      if (materials[i].diffuse_texname.empty())
+        continue;
+
+      std::string path = std::filesystem::path(modelDirectory + materials[i].diffuse_texname).lexically_normal().generic_string();
+      if (path == TEXTURE_PATH)
+        continue;
+
+      auto found = std::find(materialTexturePaths.begin(), materialTexturePaths.end(), path);
+      if (found == materialTexturePaths.end())
+      {
+        if (materialTexturePaths.size() + 1 >= MAX_MATERIAL_TEXTURES)
+          continue;
+        found = materialTexturePaths.insert(found, path);
+      }
+      elements[i] = 1 + static_cast<uint32_t>(found - materialTexturePaths.begin());
+    }
+
+    return elements;
+  }
+
+  MeshProcessing meshProcessing() const
+  {
+    MeshProcessing processing;
+    processing.optimize = options.optimizeMesh;
+    processing.reduceOverdraw = options.optimizeOverdraw;
+    processing.lodLevels = options.lodLevels;
+    return processing;
+  }
+
+  void processModel()
+  {
+    lodIndexCounts = processMesh(vertices, indices, meshProcessing(), meshOptimizationStatistics);
+
+    // Benchmark runs keep stdout for the JSON report.
+    if (options.benchmarkFrames == 0 && lodIndexCounts.size() > 1)
+    {
+      std::cout << "LOD triangles:";
+      for (uint32_t count : lodIndexCounts)
+      {
+        std::cout << " " << count / 3;
+      }
+      std::cout << std::endl;
+    }
+    if (options.benchmarkFrames == 0 && options.optimizeMesh)
+    {
+      std::cout << "mesh optimization: ACMR " << meshOptimizationStatistics.before.acmr() << " -> " << meshOptimizationStatistics.after.acmr()
+                << ", ATVR " << meshOptimizationStatistics.before.atvr() << " -> " << meshOptimizationStatistics.after.atvr() << std::endl;
+    }
+  }
+
+  static Vertex makeVertex(const tinyobj::attrib_t &attrib, const tinyobj::index_t &index, uint32_t material)
+  {
+    Vertex vertex{};
+    vertex.material = material;
+
+    vertex.pos = {
+        attrib.vertices[3 * index.vertex_index + 0],
+        attrib.vertices[3 * index.vertex_index + 1],
+        attrib.vertices[3 * index.vertex_index + 2]};
+
+    vertex.texCoord = {
+        attrib.texcoords[2 * index.texcoord_index + 0],
+        1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+
+    if (index.normal_index >= 0)
+    {
+      vertex.normal = {
+          attrib.normals[3 * index.normal_index + 0],
+          attrib.normals[3 * index.normal_index + 1],
+          attrib.normals[3 * index.normal_index + 2]};
+    }
+
+    return vertex;
+  }
+
+  // Splits the vertex stream by hash into one partition per thread, so every
+  // partition has its own table and no locking is needed. The final pass
+  // numbers vertices by first use, which gives the same vertex and index
+  // buffers as the serial path.
+  void deduplicateVerticesParallel(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::index_t> &objIndices, const std::vector<uint32_t> &objMaterials)
+  {
+    uint32_t partitionCount = options.dedupThreads;
+    size_t indexCount = objIndices.size();
+    ThreadPool pool(partitionCount);
+
+    std::vector<uint64_t> hashes(indexCount);
+    size_t rangeSize = (indexCount + partitionCount - 1) / partitionCount;
+    pool.parallelFor(partitionCount, [&](uint32_t range)
+                     {
+      size_t end = std::min(indexCount, (range + 1) * rangeSize);
+      for (size_t i = range * rangeSize; i < end; i++)
+      {
+        hashes[i] = hashVertex(makeVertex(attrib, objIndices[i], objMaterials[i]));
+      } });
+
+    auto partitionOf = [partitionCount](uint64_t hash)
+    {
+      return static_cast<uint32_t>(((hash >> 32) * partitionCount) >> 32);
+    };
+
+    std::vector<std::vector<Vertex>> partitionVertices(partitionCount);
+    std::vector<uint32_t> localIndices(indexCount);
+    pool.parallelFor(partitionCount, [&](uint32_t partition)
+                     {
+      VertexDeduplicator uniqueVertices(indexCount / partitionCount);
+      for (size_t i = 0; i < indexCount; i++)
+      {
+        if (partitionOf(hashes[i]) == partition)
+        {
+          localIndices[i] = uniqueVertices.insert(makeVertex(attrib, objIndices[i], objMaterials[i]), hashes[i], partitionVertices[partition]);
+        }
+      } });
+
+    std::vector<std::vector<uint32_t>> globalIndices(partitionCount);
+    size_t uniqueCount = 0;
+    for (uint32_t partition = 0; partition < partitionCount; partition++)
+    {
+      globalIndices[partition].assign(partitionVertices[partition].size(), std::numeric_limits<uint32_t>::max());
+      uniqueCount += partitionVertices[partition].size();
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+    vertices.reserve(uniqueCount);
+    indices.reserve(indexCount);
+    for (size_t i = 0; i < indexCount; i++)
     {
-      throw std::runtime_error("failed to allocate image memory!");
+      uint32_t partition = partitionOf(hashes[i]);
+      uint32_t &global = globalIndices[partition][localIndices[i]];
+      if (global == std::numeric_limits<uint32_t>::max())
+      {
+        global = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(partitionVertices[partition][localIndices[i]]);
+      }
+      indices.push_back(global);
     }
+  }
 
-    vkBindImageMemory(device, image, imageMemory, 0);
+  void startMeshStream()
+  {
+    meshStreamer = std::make_unique<MeshStreamer>(MODEL_PATH, options.streamMemoryBytes, meshProcessing());
   }
 
-  void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+  // Copies up to STREAM_CHUNKS_PER_FRAME finished chunks (or, with
+  // `waitForAll`, every remaining chunk) into the device buffers and appends
+  // their draw ranges.
+  void uploadMeshChunks(bool waitForAll)
   {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    while (!meshStreamer->finished())
+    {
+      std::vector<MeshChunk> chunks;
+      MeshChunk chunk;
+      while (chunks.size() < STREAM_CHUNKS_PER_FRAME && meshStreamer->pop(chunk, waitForAll))
+      {
+        chunks.push_back(std::move(chunk));
+      }
 
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+      if (chunks.empty())
+      {
+        return;
+      }
 
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
+      // One draw per LOD for everything popped together, rather than one
+      // per chunk.
+      MeshChunk pending = mergeMeshChunks(chunks);
+      reserveMeshBuffers(streamedVertexCount + static_cast<uint32_t>(pending.vertices.size()),
+                         streamedIndexCount + static_cast<uint32_t>(pending.indices.size()));
+
+      // The ranges written here are beyond anything in-flight frames draw,
+      // and the buffers are shared with the transfer queue, so the copies
+      // need no synchronization with rendering beyond the timeline wait.
+      std::vector<PackedVertex> packed;
+      VertexDequantization dequantization = packVertices(pending.vertices, packed);
+
+      VkDeviceSize vertexBytes = packed.size() * sizeof(PackedVertex);
+      UploadEngine::StagingSpan vertexStaging = uploads.stage(vertexBytes);
+      memcpy(vertexStaging.data, packed.data(), vertexBytes);
+      uploads.copyToBuffer(vertexStaging, vertexBuffer, streamedVertexCount * sizeof(PackedVertex), vertexBytes, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, false);
+
+      VkDeviceSize indexBytes = pending.indices.size() * sizeof(uint32_t);
+      UploadEngine::StagingSpan indexStaging = uploads.stage(indexBytes);
+      memcpy(indexStaging.data, pending.indices.data(), indexBytes);
+      uploads.copyToBuffer(indexStaging, indexBuffer, streamedIndexCount * sizeof(uint32_t), indexBytes, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, false);
+
+      extendMeshBounds(pending.vertices);
+      meshOptimizationStatistics.add(pending.optimization);
+      appendLodDrawRanges(meshDrawRanges, streamedIndexCount, static_cast<int32_t>(streamedVertexCount), dequantization, pending.lodIndexCounts, options.lodLevels);
+      streamedVertexCount += static_cast<uint32_t>(pending.vertices.size());
+      streamedIndexCount += static_cast<uint32_t>(pending.indices.size());
+
+      uploads.flush();
+      markSceneDirty();
+
+      if (!waitForAll)
+      {
+        return;
+      }
+    }
+  }
 
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-    {
-      barrier.srcAccessMask = 0;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  // Grows the streamed vertex and index buffers geometrically, carrying the
+  // already uploaded contents over to the new buffers.
+  void reserveMeshBuffers(uint32_t vertexCount, uint32_t indexCount)
+  {
+    if (vertexCount <= vertexCapacity && indexCount <= indexCapacity)
+      return;
 
-      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-      destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    if (vertexCount > vertexCapacity)
     {
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-      sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-      destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+      vertexCapacity = std::max({vertexCount, 2 * vertexCapacity, 3 * STREAM_CHUNK_TRIANGLES});
+      growBuffer(vertexBuffer, vertexBufferAllocation, vertexCapacity * sizeof(PackedVertex), streamedVertexCount * sizeof(PackedVertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
     }
-    else
+
+    if (indexCount > indexCapacity)
     {
-      throw std::invalid_argument("unsupported layout transition!");
+      indexCapacity = std::max({indexCount, 2 * indexCapacity, 3 * STREAM_CHUNK_TRIANGLES});
+      growBuffer(indexBuffer, indexBufferAllocation, indexCapacity * sizeof(uint32_t), streamedIndexCount * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
     }
-
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        sourceStage, destinationStage,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
   }
 
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+  // Nothing waits for rendering to go idle. The copy into the new buffer is
+  // recorded ahead of the next frame's draws, after pending uploads to the
+  // old one have landed, and the old buffer is kept until the frame
+  // timeline passes that frame. Uploads made meanwhile land beyond
+  // `usedSize` and do not overlap the copy.
+  void growBuffer(VkBuffer &buffer, Allocation &allocation, VkDeviceSize size, VkDeviceSize usedSize, VkBufferUsageFlags usage)
   {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkBuffer newBuffer;
+    Allocation newAllocation;
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newBuffer, newAllocation, true);
 
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {
-        width,
-        height,
-        1};
+    if (usedSize > 0)
+    {
+      VkBuffer oldBuffer = buffer;
+      uploads.onGraphicsQueue([oldBuffer, newBuffer, usedSize](VkCommandBuffer commandBuffer)
+                              {
+                                VkBufferCopy copyRegion{};
+                                copyRegion.size = usedSize;
+                                vkCmdCopyBuffer(commandBuffer, oldBuffer, newBuffer, 1, &copyRegion);
+
+                                // Visible to the draws and to a later growth
+                                // copying out of the new buffer.
+                                VkMemoryBarrier barrier{};
+                                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                                barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+                                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr); });
+    }
 
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    if (buffer != VK_NULL_HANDLE)
+    {
+      retiredMeshBuffers.push_back({buffer, allocation, submissionCount + 1});
+    }
 
-    endSingleTimeCommands(commandBuffer);
+    buffer = newBuffer;
+    allocation = newAllocation;
   }
 
-  void loadModel()
+  void releaseRetiredMeshBuffers()
   {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
+    uint64_t completed = completedSubmission();
+    auto released = std::remove_if(retiredMeshBuffers.begin(), retiredMeshBuffers.end(), [&](RetiredBuffer &retired)
+                                   {
+                                     if (retired.lastSubmission > completed)
+                                       return false;
+                                     vkDestroyBuffer(device, retired.buffer, nullptr);
+                                     allocator.free(retired.allocation);
+                                     return true; });
+    retiredMeshBuffers.erase(released, retiredMeshBuffers.end());
+  }
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str()))
+  void extendMeshBounds(const std::vector<Vertex> &meshVertices)
+  {
+    for (const auto &vertex : meshVertices)
     {
-      throw std::runtime_error(warn + err);
+      meshBoundsMin = glm::min(meshBoundsMin, vertex.pos);
+      meshBoundsMax = glm::max(meshBoundsMax, vertex.pos);
     }
+  }
 
-    std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+  void createVertexBuffer()
+  {
+    extendMeshBounds(vertices);
 
-    for (const auto &shape : shapes)
-    {
-      for (const auto &index : shape.mesh.indices)
-      {
-        Vertex vertex{};
+    std::vector<PackedVertex> packed;
+    meshDequantization = packVertices(vertices, packed);
 
-        vertex.pos = {
-            attrib.vertices[3 * index.vertex_index + 0],
-            attrib.vertices[3 * index.vertex_index + 1],
-            attrib.vertices[3 * index.vertex_index + 2]};
+    VkDeviceSize bufferSize = sizeof(packed[0]) * packed.size();
 
-        vertex.texCoord = {
-            attrib.texcoords[2 * index.texcoord_index + 0],
-            1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+    UploadEngine::StagingSpan staging = uploads.stage(bufferSize);
+    memcpy(staging.data, packed.data(), (size_t)bufferSize);
 
-        vertex.color = {1.0f, 1.0f, 1.0f};
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferAllocation);
 
-        if (uniqueVertices.count(vertex) == 0)
-        {
-          uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-          vertices.push_back(vertex);
-        }
+    uploads.copyToBuffer(staging, vertexBuffer, 0, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, true);
 
-        indices.push_back(uniqueVertices[vertex]);
-      }
-    }
   }
 
-  void createVertexBuffer()
+  void createIndexBuffer()
   {
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    UploadEngine::StagingSpan staging = uploads.stage(bufferSize);
+    memcpy(staging.data, indices.data(), (size_t)bufferSize);
 
-    void *data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferAllocation);
 
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+    uploads.copyToBuffer(staging, indexBuffer, 0, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, true);
 
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+    uploads.flush();
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    appendLodDrawRanges(meshDrawRanges, 0, 0, meshDequantization, lodIndexCounts, options.lodLevels);
   }
 
-  void createIndexBuffer()
+  // Lays the instances out on a cubic grid that fills the space the single
+  // model used to occupy, so any instance count stays in view.
+  static std::vector<InstanceData> makeInstanceGrid(uint32_t count)
   {
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    uint32_t side = 1;
+    while (static_cast<uint64_t>(side) * side * side < count)
+    {
+      side++;
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    float scale = 1.0f / side;
+    float center = (side - 1) / 2.0f;
 
-    void *data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    std::vector<InstanceData> instances(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      glm::vec3 cell(i % side, i / side % side, i / (side * side));
+      glm::vec3 offset = (cell - center) * 2.0f * scale;
+      instances[i].model = glm::scale(glm::translate(glm::mat4(1.0f), offset), glm::vec3(scale));
+    }
+
+    return instances;
+  }
 
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+  void createInstanceBuffer()
+  {
+    std::vector<InstanceData> instances = makeInstanceGrid(options.instanceCount);
+    VkDeviceSize bufferSize = sizeof(instances[0]) * instances.size();
+
+    UploadEngine::StagingSpan staging = uploads.stage(bufferSize);
+    memcpy(staging.data, instances.data(), (size_t)bufferSize);
 
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer, instanceBufferAllocation);
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    uploads.copyToBuffer(staging, instanceBuffer, 0, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT, true);
+
+    uploads.flush();
   }
 
   void createUniformBuffers()
   {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-    uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-    {
-      createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+    VkDeviceSize bufferSize = FrameDataRing::bufferSize(framesInFlight, FrameDataRing::DEFAULT_REGION_SIZE, alignment);
+    createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameDataBuffer, frameDataAllocation);
 
-      vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
-    }
+    frameData.init(frameDataAllocation.mapped, FrameDataRing::DEFAULT_REGION_SIZE, alignment);
   }
 
   void createDescriptorPool()
   {
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    // Culling adds a set per frame with the uniform buffer and three storage
+    // buffers. Virtual texturing adds the page table and feedback buffer.
+    uint32_t setsPerFrame = options.gpuCulling ? 2 : 1;
+    uint32_t virtualTextureDescriptors = virtualTexturing ? 1 : 0;
+
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = framesInFlight * setsPerFrame;
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[1].descriptorCount = framesInFlight * (1 + virtualTextureDescriptors);
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = framesInFlight * (3 + virtualTextureDescriptors);
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.maxSets = framesInFlight * setsPerFrame;
 
     if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
     {
       throw std::runtime_error("failed to create descriptor pool!");
     }
+
+    if (bindlessMaterials)
+    {
+      VkDescriptorPoolSize materialPoolSize{};
+      materialPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      materialPoolSize.descriptorCount = materialTextureLimit;
+
+      VkDescriptorPoolCreateInfo materialPoolInfo{};
+      materialPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      materialPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+      materialPoolInfo.poolSizeCount = 1;
+      materialPoolInfo.pPoolSizes = &materialPoolSize;
+      materialPoolInfo.maxSets = 1;
+
+      if (vkCreateDescriptorPool(device, &materialPoolInfo, nullptr, &materialDescriptorPool) != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to create material descriptor pool!");
+      }
+    }
   }
 
   void createDescriptorSets()
   {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(framesInFlight, descriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.descriptorSetCount = framesInFlight;
     allocInfo.pSetLayouts = layouts.data();
 
-    descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    descriptorSets.resize(framesInFlight);
     if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
     {
       throw std::runtime_error("failed to allocate descriptor sets!");
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    for (size_t i = 0; i < framesInFlight; i++)
     {
       VkDescriptorBufferInfo bufferInfo{};
-      bufferInfo.buffer = uniformBuffers[i];
+      bufferInfo.buffer = frameDataBuffer;
       bufferInfo.offset = 0;
       bufferInfo.range = sizeof(UniformBufferObject);
 
@@ -1233,13 +6897,23 @@ private:
       imageInfo.imageView = textureImageView;
       imageInfo.sampler = textureSampler;
 
-      std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+      VkDescriptorImageInfo pageTableInfo{};
+      pageTableInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      pageTableInfo.imageView = pageTableImageView;
+      pageTableInfo.sampler = pageTableSampler;
+
+      VkDescriptorBufferInfo feedbackInfo{};
+      feedbackInfo.buffer = virtualTexturing ? feedbackBuffers[i] : VK_NULL_HANDLE;
+      feedbackInfo.offset = 0;
+      feedbackInfo.range = VK_WHOLE_SIZE;
+
+      std::vector<VkWriteDescriptorSet> descriptorWrites(virtualTexturing ? 4 : 2);
 
       descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
       descriptorWrites[0].dstSet = descriptorSets[i];
       descriptorWrites[0].dstBinding = 0;
       descriptorWrites[0].dstArrayElement = 0;
-      descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+      descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
       descriptorWrites[0].descriptorCount = 1;
       descriptorWrites[0].pBufferInfo = &bufferInfo;
 
@@ -1251,11 +6925,144 @@ private:
       descriptorWrites[1].descriptorCount = 1;
       descriptorWrites[1].pImageInfo = &imageInfo;
 
+      if (virtualTexturing)
+      {
+        descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[2].dstSet = descriptorSets[i];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].dstArrayElement = 0;
+        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[2].descriptorCount = 1;
+        descriptorWrites[2].pImageInfo = &pageTableInfo;
+
+        descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[3].dstSet = descriptorSets[i];
+        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].dstArrayElement = 0;
+        descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[3].descriptorCount = 1;
+        descriptorWrites[3].pBufferInfo = &feedbackInfo;
+      }
+
       vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     }
+
+    if (bindlessMaterials)
+    {
+      createMaterialDescriptorSet();
+    }
+  }
+
+  // Writes elements 0 to materialCount() - 1 of the material array; the
+  // rest stay unbound.
+  void createMaterialDescriptorSet()
+  {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = materialDescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &materialDescriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, &materialDescriptorSet) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to allocate material descriptor set!");
+    }
+
+    std::vector<VkDescriptorImageInfo> imageInfos(materialCount());
+    for (uint32_t material = 0; material < imageInfos.size(); material++)
+    {
+      imageInfos[material].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      imageInfos[material].imageView = material == 0 || materialTextures[material - 1].view == VK_NULL_HANDLE ? textureImageView : materialTextures[material - 1].view;
+      imageInfos[material].sampler = textureSampler;
+    }
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = materialDescriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = static_cast<uint32_t>(imageInfos.size());
+    descriptorWrite.pImageInfo = imageInfos.data();
+
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+  }
+
+  void createCullBuffers()
+  {
+    std::vector<VkDescriptorSetLayout> layouts(framesInFlight, cullDescriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = framesInFlight;
+    allocInfo.pSetLayouts = layouts.data();
+
+    cullDescriptorSets.resize(framesInFlight);
+    if (vkAllocateDescriptorSets(device, &allocInfo, cullDescriptorSets.data()) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to allocate cull descriptor sets!");
+    }
+
+    visibleInstanceBuffers.resize(framesInFlight);
+    visibleInstanceBuffersAllocations.resize(framesInFlight);
+    indirectBuffers.resize(framesInFlight, VK_NULL_HANDLE);
+    indirectBuffersAllocations.resize(framesInFlight);
+    indirectBufferCapacities.resize(framesInFlight, 0);
+
+    for (size_t i = 0; i < framesInFlight; i++)
+    {
+      createBuffer(sizeof(InstanceData) * options.instanceCount * options.lodLevels, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibleInstanceBuffers[i], visibleInstanceBuffersAllocations[i]);
+      reserveIndirectBuffer(static_cast<uint32_t>(i), std::max<uint32_t>(64, static_cast<uint32_t>(meshDrawRanges.size())));
+    }
+  }
+
+  // (Re)creates a frame's indirect command buffer when the mesh has more
+  // draw ranges than it holds, and points the frame's cull set at it. Only
+  // called for a frame whose previous submission has completed.
+  void reserveIndirectBuffer(uint32_t frame, uint32_t drawCount)
+  {
+    if (drawCount <= indirectBufferCapacities[frame])
+      return;
+
+    if (indirectBuffers[frame] != VK_NULL_HANDLE)
+    {
+      vkDestroyBuffer(device, indirectBuffers[frame], nullptr);
+      allocator.free(indirectBuffersAllocations[frame]);
+      markSceneDirty();
+    }
+
+    indirectBufferCapacities[frame] = std::max(drawCount, 2 * indirectBufferCapacities[frame]);
+    createBuffer(INDIRECT_COMMANDS_OFFSET + sizeof(VkDrawIndexedIndirectCommand) * indirectBufferCapacities[frame], VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indirectBuffers[frame], indirectBuffersAllocations[frame]);
+
+    std::array<VkDescriptorBufferInfo, 4> bufferInfos{};
+    bufferInfos[0] = {frameDataBuffer, 0, sizeof(UniformBufferObject)};
+    bufferInfos[1] = {instanceBuffer, 0, VK_WHOLE_SIZE};
+    bufferInfos[2] = {visibleInstanceBuffers[frame], 0, VK_WHOLE_SIZE};
+    bufferInfos[3] = {indirectBuffers[frame], 0, VK_WHOLE_SIZE};
+
+    std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+    for (uint32_t i = 0; i < descriptorWrites.size(); i++)
+    {
+      descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[i].dstSet = cullDescriptorSets[frame];
+      descriptorWrites[i].dstBinding = i;
+      descriptorWrites[i].dstArrayElement = 0;
+      descriptorWrites[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      descriptorWrites[i].descriptorCount = 1;
+      descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+  }
+
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, Allocation &bufferAllocation)
+  {
+    createBuffer(size, usage, properties, buffer, bufferAllocation, false);
   }
 
-  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &bufferMemory)
+  // Buffers shared with the upload queue can be written there while the
+  // graphics queue reads other ranges, without ownership transfers.
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, Allocation &bufferAllocation, bool sharedWithUploads)
   {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1263,6 +7070,17 @@ private:
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    uint32_t queueFamilyIndices[2];
+    if (sharedWithUploads && uploads.ownershipTransfers())
+    {
+      queueFamilyIndices[0] = findQueueFamilies(physicalDevice).graphicsFamily.value();
+      queueFamilyIndices[1] = uploads.queueFamily();
+
+      bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      bufferInfo.queueFamilyIndexCount = 2;
+      bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+
     if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
     {
       throw std::runtime_error("failed to create buffer!");
@@ -1271,17 +7089,10 @@ private:
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-    {
-      throw std::runtime_error("failed to allocate buffer memory!");
-    }
+    uint32_t memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    bufferAllocation = allocator.allocate(memRequirements, memoryTypeIndex, true);
 
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    vkBindBufferMemory(device, buffer, bufferAllocation.memory, bufferAllocation.offset);
   }
 
   VkCommandBuffer beginSingleTimeCommands()
@@ -1313,7 +7124,10 @@ private:
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to submit single-time commands!");
+    }
     vkQueueWaitIdle(graphicsQueue);
 
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
@@ -1335,31 +7149,236 @@ private:
     VkPhysicalDeviceMemoryProperties memProperties;
     vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+    return findMemoryTypeIndex(memProperties, typeFilter, properties);
+  }
+
+  void createCommandBuffers()
+  {
+    commandBuffers.resize(framesInFlight);
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to allocate command buffers!");
+    }
+
+    uploadCommandBuffers.resize(framesInFlight);
+    if (vkAllocateCommandBuffers(device, &allocInfo, uploadCommandBuffers.data()) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to allocate upload command buffers!");
+    }
+
+    if (options.recordThreads > 0)
+    {
+      createSecondaryCommandBuffers();
+    }
+
+    if (options.cacheCommandBuffers)
+    {
+      createCachedCommandBuffers();
+    }
+  }
+
+  // (Re)allocates a cached command buffer for every pair of framebuffer and
+  // frame in flight. All of them start out unrecorded.
+  void createCachedCommandBuffers()
+  {
+    if (!cachedCommandBuffers.empty())
+    {
+      vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(cachedCommandBuffers.size()), cachedCommandBuffers.data());
+    }
+
+    cachedCommandBuffers.resize(swapChainFramebuffers.size() * framesInFlight);
+    cachedCommandBufferVersions.assign(cachedCommandBuffers.size(), 0);
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(cachedCommandBuffers.size());
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, cachedCommandBuffers.data()) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to allocate cached command buffers!");
+    }
+  }
+
+  // Invalidates every cached command buffer. Call it after anything a
+  // recording captures changes: pipelines, bound buffers or the draw list.
+  void markSceneDirty()
+  {
+    sceneVersion++;
+  }
+
+  void createSecondaryCommandBuffers()
+  {
+    recordPool = std::make_unique<ThreadPool>(options.recordThreads);
+
+    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+    size_t count = framesInFlight * options.recordThreads;
+    secondaryCommandPools.resize(count);
+    secondaryCommandBuffers.resize(count);
+
+    for (size_t i = 0; i < count; i++)
     {
-      if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+      if (vkCreateCommandPool(device, &poolInfo, nullptr, &secondaryCommandPools[i]) != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to create secondary command pool!");
+      }
+
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = secondaryCommandPools[i];
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      allocInfo.commandBufferCount = 1;
+
+      if (vkAllocateCommandBuffers(device, &allocInfo, &secondaryCommandBuffers[i]) != VK_SUCCESS)
       {
-        return i;
+        throw std::runtime_error("failed to allocate secondary command buffers!");
       }
     }
-
-    throw std::runtime_error("failed to find suitable memory type!");
   }
 
-  void createCommandBuffers()
+  void createTimestampQueryPool()
+  {
+    if (options.benchmarkFrames == 0)
+      return;
+
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    timestampValidBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+    if (timestampValidBits == 0)
+    {
+      std::cerr << "GPU timestamps are not supported on the graphics queue, skipping GPU timings" << std::endl;
+      return;
+    }
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2 * framesInFlight;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create timestamp query pool!");
+    }
+
+    timestampsWritten.assign(framesInFlight, false);
+  }
+
+  void collectTimestamps(uint32_t frame)
+  {
+    if (timestampQueryPool == VK_NULL_HANDLE || !timestampsWritten[frame])
+      return;
+
+    std::array<uint64_t, 2> timestamps{};
+    if (vkGetQueryPoolResults(device, timestampQueryPool, 2 * frame, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+    {
+      uint64_t mask = timestampValidBits >= 64 ? ~0ULL : (1ULL << timestampValidBits) - 1;
+      uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+      gpuTimings.record("renderPass", ticks * static_cast<double>(timestampPeriod) / 1e6);
+    }
+
+    timestampsWritten[frame] = false;
+  }
+
+  void recordStage(const std::string &name, std::chrono::steady_clock::time_point &stageStart)
+  {
+    auto now = std::chrono::steady_clock::now();
+    if (options.benchmarkFrames > 0)
+    {
+      cpuTimings.record(name, std::chrono::duration<double, std::milli>(now - stageStart).count());
+    }
+    stageStart = now;
+  }
+
+  void printBenchmarkReport(uint32_t frames, double totalSeconds)
   {
-    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
-    {
-      throw std::runtime_error("failed to allocate command buffers!");
-    }
+    std::cout << "{\n"
+              << "  \"device\": \"" << escapeJson(properties.deviceName) << "\",\n"
+              << "  \"headless\": " << (options.headless ? "true" : "false") << ",\n"
+              << "  \"width\": " << swapChainExtent.width << ",\n"
+              << "  \"height\": " << swapChainExtent.height << ",\n"
+              << "  \"instances\": " << options.instanceCount << ",\n"
+              << "  \"gpuCulling\": " << (options.gpuCulling ? "true" : "false") << ",\n"
+              << "  \"renderMode\": \"" << RENDER_MODES[renderMode].name << "\",\n"
+              << "  \"graphicsPipelineLibrary\": " << (graphicsPipelineLibrarySupported ? "true" : "false") << ",\n"
+              << "  \"virtualTexture\": " << (virtualTexturing ? "true" : "false") << ",\n"
+              << "  \"residentPages\": " << (virtualTexture ? virtualTexture->residentPages() : 0) << ",\n"
+              << "  \"bindlessMaterials\": " << (bindlessMaterials ? "true" : "false") << ",\n"
+              << "  \"materials\": " << materialCount() << ",\n"
+              << "  \"lodLevels\": " << options.lodLevels << ",\n"
+              << "  \"recordThreads\": " << options.recordThreads << ",\n"
+              << "  \"framesInFlight\": " << framesInFlight << ",\n"
+              << "  \"swapchainImages\": " << swapChainImages.size() << ",\n"
+              << "  \"presentMode\": \"" << (options.headless ? "none" : presentModeName(swapChainPresentMode)) << "\",\n"
+              << "  \"targetFps\": " << options.targetFps << ",\n"
+              << "  \"cacheCommandBuffers\": " << (options.cacheCommandBuffers ? "true" : "false") << ",\n"
+              << "  \"commandBufferRecordings\": " << commandBufferRecordings << ",\n"
+              << "  \"frames\": " << frames << ",\n"
+              << "  \"totalSeconds\": " << totalSeconds << ",\n"
+              << "  \"timeToFirstFrameMilliseconds\": " << std::chrono::duration<double, std::milli>(firstFrameTime - PROCESS_START).count() << ",\n"
+              << "  \"fps\": " << frames / totalSeconds << ",\n"
+              << "  \"cpuMilliseconds\": ";
+    cpuTimings.writeJson(std::cout, "  ");
+    std::cout << ",\n"
+              << "  \"gpuMilliseconds\": ";
+    gpuTimings.writeJson(std::cout, "  ");
+
+    AllocatorStatistics memory = allocator.statistics();
+    std::cout << ",\n"
+              << "  \"memory\": {\n"
+              << "    \"deviceMemoryCount\": " << memory.deviceMemoryCount << ",\n"
+              << "    \"blockCount\": " << memory.blockCount << ",\n"
+              << "    \"dedicatedCount\": " << memory.dedicatedCount << ",\n"
+              << "    \"allocationCount\": " << memory.allocationCount << ",\n"
+              << "    \"bytesInUse\": " << memory.bytesInUse << ",\n"
+              << "    \"blockBytes\": " << memory.blockBytes << ",\n"
+              << "    \"dedicatedBytes\": " << memory.dedicatedBytes << ",\n"
+              << "    \"internalFragmentation\": " << memory.internalFragmentation() << ",\n"
+              << "    \"externalFragmentation\": " << memory.externalFragmentation() << "\n"
+              << "  },\n"
+              << "  \"meshOptimization\": {\n"
+              << "    \"enabled\": " << (options.optimizeMesh ? "true" : "false") << ",\n"
+              << "    \"overdraw\": " << (options.optimizeOverdraw ? "true" : "false") << ",\n"
+              << "    \"acmrBefore\": " << meshOptimizationStatistics.before.acmr() << ",\n"
+              << "    \"acmrAfter\": " << meshOptimizationStatistics.after.acmr() << ",\n"
+              << "    \"atvrBefore\": " << meshOptimizationStatistics.before.atvr() << ",\n"
+              << "    \"atvrAfter\": " << meshOptimizationStatistics.after.atvr() << "\n"
+              << "  },\n"
+              << "  \"pipelineCache\": {\n"
+              << "    \"loadedBytes\": " << pipelineCacheStatistics.loadedBytes << ",\n"
+              << "    \"hits\": " << pipelineCacheStatistics.hits << ",\n"
+              << "    \"misses\": " << pipelineCacheStatistics.misses << ",\n"
+              << "    \"unknown\": " << pipelineCacheStatistics.unknown << ",\n"
+              << "    \"hitMilliseconds\": " << pipelineCacheStatistics.hitMilliseconds << ",\n"
+              << "    \"missMilliseconds\": " << pipelineCacheStatistics.missMilliseconds << ",\n"
+              << "    \"unknownMilliseconds\": " << pipelineCacheStatistics.unknownMilliseconds << "\n"
+              << "  }";
+    std::cout << "\n}" << std::endl;
   }
 
   void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
@@ -1371,6 +7390,18 @@ private:
     {
       throw std::runtime_error("failed to begin recording command buffer!");
     }
+    commandBufferRecordings++;
+
+    if (timestampQueryPool != VK_NULL_HANDLE)
+    {
+      vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 2 * currentFrame, 2);
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 2 * currentFrame);
+    }
+
+    if (options.gpuCulling && !meshDrawRanges.empty())
+    {
+      recordCulling(commandBuffer);
+    }
 
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1386,8 +7417,111 @@ private:
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    if (recordPool)
+    {
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+      std::vector<VkCommandBuffer> secondaries = recordSecondaryCommandBuffers(imageIndex);
+      if (!secondaries.empty())
+      {
+        vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+      }
+    }
+    else
+    {
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+      recordDraws(commandBuffer, 0, static_cast<uint32_t>(meshDrawRanges.size()), 0, options.instanceCount);
+    }
+
+    vkCmdEndRenderPass(commandBuffer);
+
+    if (virtualTexturing)
+    {
+      // The feedback is read on the host once the frame completes.
+      VkMemoryBarrier feedbackBarrier{};
+      feedbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      feedbackBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      feedbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &feedbackBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    if (timestampQueryPool != VK_NULL_HANDLE)
+    {
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 2 * currentFrame + 1);
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to record command buffer!");
+    }
+  }
+
+  // Splits the draws into one contiguous slice per worker and records each
+  // slice into that worker's secondary buffer for this frame. Returns the
+  // buffers that got a slice, in draw order.
+  //
+  // A loaded model has a single range per LOD, so with fewer ranges than
+  // workers every slice draws all ranges for its share of the instances
+  // instead. Culled instance counts are only known on the GPU, so with
+  // --gpu-culling the split stays by range.
+  std::vector<VkCommandBuffer> recordSecondaryCommandBuffers(uint32_t imageIndex)
+  {
+    uint32_t threadCount = options.recordThreads;
+    uint32_t rangeCount = static_cast<uint32_t>(meshDrawRanges.size());
+    bool byInstance = !options.gpuCulling && rangeCount > 0 && rangeCount < threadCount;
+    uint32_t itemCount = byInstance ? options.instanceCount : rangeCount;
+    uint32_t sliceSize = (itemCount + threadCount - 1) / threadCount;
+    uint32_t sliceCount = sliceSize == 0 ? 0 : (itemCount + sliceSize - 1) / sliceSize;
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+
+    recordPool->parallelFor(sliceCount, [&](uint32_t slice)
+                            {
+      size_t index = currentFrame * threadCount + slice;
+      vkResetCommandPool(device, secondaryCommandPools[index], 0);
+
+      VkCommandBufferBeginInfo beginInfo{};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+      beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+      VkCommandBuffer secondary = secondaryCommandBuffers[index];
+      if (vkBeginCommandBuffer(secondary, &beginInfo) != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to begin recording secondary command buffer!");
+      }
+
+      uint32_t first = slice * sliceSize;
+      uint32_t count = std::min(sliceSize, itemCount - first);
+      if (byInstance)
+      {
+        recordDraws(secondary, 0, rangeCount, first, count);
+      }
+      else
+      {
+        recordDraws(secondary, first, count, 0, options.instanceCount);
+      }
+
+      if (vkEndCommandBuffer(secondary) != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to record secondary command buffer!");
+      } });
+
+    return std::vector<VkCommandBuffer>(secondaryCommandBuffers.begin() + currentFrame * threadCount,
+                                        secondaryCommandBuffers.begin() + currentFrame * threadCount + sliceCount);
+  }
 
+  // Records the draws of meshDrawRanges[first, first + count) along with all
+  // state they need, so that it works for primary and secondary buffers.
+  // Without culling only instances [firstInstance, firstInstance +
+  // instanceCount) are drawn.
+  void recordDraws(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count, uint32_t firstInstance, uint32_t instanceCount)
+  {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
     VkViewport viewport{};
@@ -1404,48 +7538,192 @@ private:
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    if (count > 0)
+    {
+      VkBuffer vertexBuffers[] = {vertexBuffer, options.gpuCulling ? visibleInstanceBuffers[currentFrame] : instanceBuffer};
+      VkDeviceSize offsets[] = {0, 0};
+      vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
 
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+      vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &uniformOffset);
+      if (bindlessMaterials)
+      {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &materialDescriptorSet, 0, nullptr);
+      }
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+      // Every range is quantized against its own bounds, so each draw gets
+      // its own dequantization constants.
+      uint32_t boundLod = 0;
+      for (uint32_t i = first; i < first + count; i++)
+      {
+        const auto &range = meshDrawRanges[i];
+        if (range.lod != 0 && !options.gpuCulling)
+          continue;
 
-    vkCmdEndRenderPass(commandBuffer);
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(range.dequantization), &range.dequantization);
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        if (options.gpuCulling)
+        {
+          // Each level has its own slice of the visible instances. Binding
+          // at an offset avoids relying on drawIndirectFirstInstance.
+          if (range.lod != boundLod)
+          {
+            VkDeviceSize offset = sizeof(InstanceData) * options.instanceCount * range.lod;
+            vkCmdBindVertexBuffers(commandBuffer, 1, 1, &visibleInstanceBuffers[currentFrame], &offset);
+            boundLod = range.lod;
+          }
+
+          uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+          vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[currentFrame], INDIRECT_COMMANDS_OFFSET + i * stride, 1, stride);
+        }
+        else
+        {
+          vkCmdDrawIndexed(commandBuffer, range.indexCount, instanceCount, range.firstIndex, range.vertexOffset, firstInstance);
+        }
+      }
+    }
+  }
+
+  // Writes this frame's indirect commands and LOD counters with zero
+  // instances. This happens on every frame, also when the command buffer
+  // itself is cached.
+  void writeIndirectCommands()
+  {
+    uint32_t drawCount = static_cast<uint32_t>(meshDrawRanges.size());
+    reserveIndirectBuffer(currentFrame, drawCount);
+
+    auto *mapped = static_cast<char *>(indirectBuffersAllocations[currentFrame].mapped);
+    memset(mapped, 0, INDIRECT_COMMANDS_OFFSET);
+    auto *commands = reinterpret_cast<VkDrawIndexedIndirectCommand *>(mapped + INDIRECT_COMMANDS_OFFSET);
+    for (uint32_t i = 0; i < drawCount; i++)
     {
-      throw std::runtime_error("failed to record command buffer!");
+      commands[i].indexCount = meshDrawRanges[i].indexCount;
+      commands[i].instanceCount = 0;
+      commands[i].firstIndex = meshDrawRanges[i].firstIndex;
+      commands[i].vertexOffset = meshDrawRanges[i].vertexOffset;
+      commands[i].firstInstance = 0;
+    }
+  }
+
+  // Records the cull dispatch that sorts the visible instances by LOD and
+  // counts them in the counters ahead of the indirect commands. Every draw
+  // range of a level covers the same instances, so each command then gets
+  // a copy of its level's count.
+  void recordCulling(VkCommandBuffer commandBuffer)
+  {
+    uint32_t drawCount = static_cast<uint32_t>(meshDrawRanges.size());
+
+    CullParameters parameters{};
+    glm::vec3 center = (meshBoundsMin + meshBoundsMax) * 0.5f;
+    parameters.boundingSphere = glm::vec4(center, glm::length(meshBoundsMax - center));
+    parameters.instanceCount = options.instanceCount;
+    parameters.lodCount = options.lodLevels;
+    parameters.lodScreenSize = LOD_SCREEN_SIZE;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[currentFrame], 1, &uniformOffset);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(parameters), &parameters);
+    vkCmdDispatch(commandBuffer, (options.instanceCount + 63) / 64, 1, 1);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    std::vector<VkBufferCopy> regions(drawCount);
+    for (uint32_t i = 0; i < drawCount; i++)
+    {
+      regions[i].srcOffset = meshDrawRanges[i].lod * sizeof(uint32_t);
+      regions[i].dstOffset = INDIRECT_COMMANDS_OFFSET + i * sizeof(VkDrawIndexedIndirectCommand) + offsetof(VkDrawIndexedIndirectCommand, instanceCount);
+      regions[i].size = sizeof(uint32_t);
     }
+    vkCmdCopyBuffer(commandBuffer, indirectBuffers[currentFrame], indirectBuffers[currentFrame], static_cast<uint32_t>(regions.size()), regions.data());
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
   }
 
   void createSyncObjects()
   {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    frameStartTimes.resize(framesInFlight);
+    frameSubmissions.assign(framesInFlight, 0);
+    latencyPending.assign(framesInFlight, false);
+
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo timelineSemaphoreInfo{};
+    timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    timelineSemaphoreInfo.pNext = &timelineInfo;
+
+    if (vkCreateSemaphore(device, &timelineSemaphoreInfo, nullptr, &frameTimeline) != VK_SUCCESS)
+    {
+      throw std::runtime_error("failed to create frame timeline semaphore!");
+    }
+
+    imageAvailableSemaphores.resize(framesInFlight);
 
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    for (size_t i = 0; i < framesInFlight; i++)
     {
-      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-          vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-          vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS)
       {
         throw std::runtime_error("failed to create synchronization objects for a frame!");
       }
     }
+
+    createPresentSemaphores();
+  }
+
+  void createPresentSemaphores()
+  {
+    if (options.headless)
+      return;
+
+    presentSemaphores.resize(swapChainImages.size());
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (size_t i = 0; i < presentSemaphores.size(); i++)
+    {
+      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &presentSemaphores[i]) != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to create present semaphore!");
+      }
+    }
+  }
+
+  uint64_t completedSubmission()
+  {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, frameTimeline, &value);
+    return value;
+  }
+
+  void waitForSubmission(uint64_t value)
+  {
+    if (value == 0)
+      return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &frameTimeline;
+    waitInfo.pValues = &value;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
   }
 
+  // Rewinds the frame's region of the data ring and writes the frame's
+  // uniforms first, so their offset only depends on the frame slot and
+  // cached command buffers stay valid.
   void updateUniformBuffer(uint32_t currentImage)
   {
     static auto startTime = std::chrono::high_resolution_clock::now();
@@ -1458,60 +7736,282 @@ private:
     ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
     ubo.proj[1][1] *= -1;
+    ubo.modelViewProj = ubo.proj * ubo.view * ubo.model;
 
-    memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+    frameData.begin(currentImage);
+    uniformOffset = frameData.push(ubo);
   }
 
-  void drawFrame()
+  // Marks the start of a frame, first sleeping until the pacer's next start
+  // if there is one. Frames completing meanwhile have their latency noted.
+  void paceFrame()
   {
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    auto stageStart = FramePacer::Clock::now();
+    auto now = stageStart;
+
+    if (framePacer)
+    {
+      auto deadline = framePacer->nextFrameStart(now);
+      while (true)
+      {
+        uint64_t completed = completedSubmission();
+        for (uint32_t frame = 0; frame < framesInFlight; frame++)
+        {
+          if (latencyPending[frame] && frameSubmissions[frame] <= completed)
+          {
+            completeFrameLatency(frame);
+          }
+        }
 
-    uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        now = FramePacer::Clock::now();
+        if (now >= deadline)
+          break;
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        std::this_thread::sleep_for(std::min<FramePacer::Clock::duration>(deadline - now, std::chrono::milliseconds(1)));
+      }
+      framePacer->frameStarted(now);
+    }
+
+    frameStart = now;
+    recordStage("pacing", stageStart);
+  }
+
+  // Called once the frame timeline is known to have reached the frame.
+  void completeFrameLatency(uint32_t frame)
+  {
+    if (!latencyPending[frame])
+      return;
+    latencyPending[frame] = false;
+
+    auto latency = FramePacer::Clock::now() - frameStartTimes[frame];
+    if (framePacer)
     {
-      recreateSwapChain();
+      framePacer->frameCompleted(latency);
+    }
+    if (options.benchmarkFrames > 0)
+    {
+      cpuTimings.record("latency", std::chrono::duration<double, std::milli>(latency).count());
+    }
+  }
+
+  // Switches to a pipeline the shader reloader has finished, if any. The
+  // old one may still be used by frames in flight, so it is retired until
+  // the frame timeline passes the last submission so far.
+  void swapReloadedPipeline()
+  {
+    VkPipeline pipeline = shaderReloader->takePipeline();
+    if (pipeline == VK_NULL_HANDLE)
       return;
+
+    // Every mode's pipeline was built from the old shaders.
+    for (VkPipeline &modePipeline : renderModePipelines)
+    {
+      retirePipeline(modePipeline);
+      modePipeline = VK_NULL_HANDLE;
+    }
+    shaderGeneration++;
+
+    uint32_t mode;
+    {
+      std::lock_guard<std::mutex> lock(pipelineMutex);
+      mode = reloadedRenderMode;
+      if (reloadedLibraries)
+      {
+        pipelineLibraries = std::move(reloadedLibraries);
+      }
+    }
+
+    renderModePipelines[mode] = pipeline;
+    if (pipelineLibraries)
+    {
+      queueOptimizedLink(mode);
+    }
+    useRenderMode(renderMode);
+    if (!pipelineLibraries)
+    {
+      queuePipelineBuilds();
+    }
+  }
+
+  void drawFrame()
+  {
+    auto recordStart = std::chrono::steady_clock::now();
+    auto stageStart = recordStart;
+
+    waitForSubmission(frameSubmissions[currentFrame]);
+    completeFrameLatency(currentFrame);
+    collectTimestamps(currentFrame);
+    if (!retiredSwapChains.empty())
+    {
+      releaseRetiredSwapChains();
+    }
+    recordStage("fenceWait", stageStart);
+
+    if (shaderReloader)
+    {
+      swapReloadedPipeline();
+    }
+    adoptOptimizedPipelines();
+    if (!retiredPipelines.empty())
+    {
+      releaseRetiredPipelines();
+    }
+    if (!retiredMeshBuffers.empty())
+    {
+      releaseRetiredMeshBuffers();
+    }
+    if (virtualTexture)
+    {
+      collectVirtualTextureFeedback(currentFrame);
     }
-    else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+
+    // Offscreen targets are owned per frame in flight, so there is nothing to acquire.
+    uint32_t imageIndex = currentFrame;
+    if (!options.headless)
     {
-      throw std::runtime_error("failed to acquire swap chain image!");
+      VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+      if (result == VK_ERROR_OUT_OF_DATE_KHR)
+      {
+        recreateSwapChain();
+        return;
+      }
+      else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+      {
+        throw std::runtime_error("failed to acquire swap chain image!");
+      }
     }
+    recordStage("acquire", stageStart);
 
     updateUniformBuffer(currentFrame);
+    recordStage("updateUniformBuffer", stageStart);
 
-    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    if (options.gpuCulling)
+    {
+      writeIndirectCommands();
+    }
 
-    vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
+    if (options.cacheCommandBuffers)
+    {
+      size_t cacheIndex = imageIndex * framesInFlight + currentFrame;
+      commandBuffer = cachedCommandBuffers[cacheIndex];
+      if (cachedCommandBufferVersions[cacheIndex] != sceneVersion)
+      {
+        vkResetCommandBuffer(commandBuffer, 0);
+        recordCommandBuffer(commandBuffer, imageIndex);
+        cachedCommandBufferVersions[cacheIndex] = sceneVersion;
+      }
+    }
+    else
+    {
+      vkResetCommandBuffer(commandBuffer, /*VkCommandBufferResetFlagBits*/ 0);
+      recordCommandBuffer(commandBuffer, imageIndex);
+    }
+    recordStage("recordCommandBuffer", stageStart);
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
+    std::vector<VkCommandBuffer> submitCommandBuffers;
+    uint64_t submission = submissionCount + 1;
+    std::vector<VkSemaphore> signalSemaphores = {frameTimeline};
+    std::vector<uint64_t> signalValues = {submission};
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+    if (!options.headless)
+    {
+      waitSemaphores.push_back(imageAvailableSemaphores[currentFrame]);
+      waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+      waitValues.push_back(0);
 
-    VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
+      signalSemaphores.push_back(presentSemaphores[imageIndex]);
+      signalValues.push_back(0);
+    }
+
+    // Virtual texture pages loaded since the last frame go in with this one.
+    std::vector<VirtualTexture::Tile> tiles;
+    std::vector<uint32_t> pageTable;
+    if (virtualTexture)
+    {
+      tiles = virtualTexture->takeLoaded(VT_UPLOADS_PER_FRAME, submission);
+      virtualTexture->takePageTable(pageTable);
+    }
+
+    // Finished uploads are acquired at the start of the frame's own batch,
+    // which waits for them on the upload timeline.
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    bool virtualTextureWork = !tiles.empty() || !pageTable.empty();
+    if (uploads.hasGraphicsWork() || virtualTextureWork)
+    {
+      VkCommandBuffer uploadCommandBuffer = uploadCommandBuffers[currentFrame];
+      vkResetCommandBuffer(uploadCommandBuffer, 0);
+
+      VkCommandBufferBeginInfo beginInfo{};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+      vkBeginCommandBuffer(uploadCommandBuffer, &beginInfo);
+      if (uploads.hasGraphicsWork())
+      {
+        uint64_t uploadValue = uploads.recordGraphicsWork(uploadCommandBuffer);
+        waitSemaphores.push_back(uploads.semaphore());
+        waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+        waitValues.push_back(uploadValue);
+      }
+      if (virtualTextureWork)
+      {
+        recordVirtualTextureUpdates(uploadCommandBuffer, tiles, pageTable);
+      }
+      vkEndCommandBuffer(uploadCommandBuffer);
+
+      submitCommandBuffers.push_back(uploadCommandBuffer);
+    }
+    submitCommandBuffers.push_back(commandBuffer);
+
+    timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+
+    submitInfo.commandBufferCount = static_cast<uint32_t>(submitCommandBuffers.size());
+    submitInfo.pCommandBuffers = submitCommandBuffers.data();
+
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
     {
       throw std::runtime_error("failed to submit draw command buffer!");
     }
+    if (timestampQueryPool != VK_NULL_HANDLE)
+    {
+      timestampsWritten[currentFrame] = true;
+    }
+    frameStartTimes[currentFrame] = frameStart;
+    latencyPending[currentFrame] = true;
+    frameSubmissions[currentFrame] = submissionCount = submission;
+    recordStage("submit", stageStart);
+
+    if (options.headless)
+    {
+      recordStage("frame", recordStart);
+      currentFrame = (currentFrame + 1) % framesInFlight;
+      return;
+    }
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.pWaitSemaphores = &presentSemaphores[imageIndex];
 
     VkSwapchainKHR swapChains[] = {swapChain};
     presentInfo.swapchainCount = 1;
@@ -1519,19 +8019,36 @@ private:
 
     presentInfo.pImageIndices = &imageIndex;
 
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
+    VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
     {
       framebufferResized = false;
       recreateSwapChain();
     }
+    else if (result == VK_SUBOPTIMAL_KHR || framebufferResized)
+    {
+      // A suboptimal swap chain still presents, so while the window is being
+      // dragged the recreation waits for the resize events to settle.
+      if (!framebufferResized)
+      {
+        framebufferResized = true;
+        lastResizeEvent = std::chrono::steady_clock::now();
+      }
+      if (std::chrono::steady_clock::now() - lastResizeEvent >= RESIZE_COALESCE_INTERVAL)
+      {
+        framebufferResized = false;
+        recreateSwapChain();
+      }
+    }
     else if (result != VK_SUCCESS)
     {
       throw std::runtime_error("failed to present swap chain image!");
     }
+    recordStage("present", stageStart);
+    recordStage("frame", recordStart);
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    currentFrame = (currentFrame + 1) % framesInFlight;
   }
 
   VkShaderModule createShaderModule(const std::vector<char> &code)
@@ -1565,6 +8082,15 @@ private:
 
   VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes)
   {
+    if (options.presentMode)
+    {
+      if (std::find(availablePresentModes.begin(), availablePresentModes.end(), *options.presentMode) != availablePresentModes.end())
+      {
+        return *options.presentMode;
+      }
+      std::cerr << "present mode " << presentModeName(*options.presentMode) << " is not supported, using the default" << std::endl;
+    }
+
     for (const auto &availablePresentMode : availablePresentModes)
     {
       if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
@@ -1631,17 +8157,48 @@ private:
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported)
+    bool swapChainAdequate = options.headless;
+    if (extensionsSupported && !options.headless)
     {
       SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
       swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
 
-    VkPhysicalDeviceFeatures supportedFeatures;
-    vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_2)
+    {
+      return false;
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 supportedFeatures{};
+    supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(device, &supportedFeatures);
+
+    return indices.isComplete() && extensionsSupported && swapChainAdequate && vulkan12Features.timelineSemaphore;
+  }
+
+  bool deviceExtensionSupported(VkPhysicalDevice device, const char *name)
+  {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto &extension : availableExtensions)
+    {
+      if (strcmp(extension.extensionName, name) == 0)
+      {
+        return true;
+      }
+    }
 
-    return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+    return false;
   }
 
   bool checkDeviceExtensionSupport(VkPhysicalDevice device)
@@ -1652,6 +8209,7 @@ private:
     std::vector<VkExtensionProperties> availableExtensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
+    auto deviceExtensions = getRequiredDeviceExtensions();
     std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
     for (const auto &extension : availableExtensions)
@@ -1681,7 +8239,15 @@ private:
       }
 
       VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      if (options.headless)
+      {
+        // Nothing is presented, so the graphics queue doubles as the "present" queue.
+        presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+      }
+      else
+      {
+        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      }
 
       if (presentSupport)
       {
@@ -1696,16 +8262,39 @@ private:
       i++;
     }
 
+    // Uploads prefer a transfer-only family (usually a DMA engine), then any
+    // other non-graphics family that can transfer, then the graphics family.
+    for (uint32_t family = 0; family < queueFamilyCount; family++)
+    {
+      VkQueueFlags flags = queueFamilies[family].queueFlags;
+      if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+        continue;
+
+      if (!indices.transferFamily || !(flags & VK_QUEUE_COMPUTE_BIT))
+      {
+        indices.transferFamily = family;
+      }
+    }
+    if (!indices.transferFamily)
+    {
+      indices.transferFamily = indices.graphicsFamily;
+    }
+
     return indices;
   }
 
   std::vector<const char *> getRequiredExtensions()
   {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char *> extensions;
+
+    if (!options.headless)
+    {
+      uint32_t glfwExtensionCount = 0;
+      const char **glfwExtensions;
+      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-    std::vector<const char *> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+      extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (enableValidationLayers)
     {
@@ -1715,6 +8304,16 @@ private:
     return extensions;
   }
 
+  std::vector<const char *> getRequiredDeviceExtensions()
+  {
+    if (options.headless)
+    {
+      return {};
+    }
+
+    return swapChainDeviceExtensions;
+  }
+
   bool checkValidationLayerSupport()
   {
     uint32_t layerCount;
@@ -1773,12 +8372,11 @@ private:
   }
 };
 
-int main()
+int main(int argc, char **argv)
 {
-  HelloTriangleApplication app;
-
   try
   {
+    HelloTriangleApplication app(parseOptions(argc, argv));
     app.run();
   }
   catch (const std::exception &e)